@@ -2,18 +2,418 @@
 
 #include "LasLoader.h"
 #include <fstream>
+#include <charconv>
 #include <sstream>
+#include <filesystem>
 #include <limits>
 #include <stdio.h>
 #include <iostream>
+#include <utility>
+#include <numeric>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <unordered_set>
+#include <condition_variable>
+#include <memory>
+#include <cstdlib>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// io_uring is driven through raw syscalls, so only the kernel headers are needed
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define LAS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <cerrno>
+#endif
+
+// Vectorized coordinate dequantization is only built for x64, everything else uses the scalar kernel
+#if defined(__x86_64__) || defined(_M_X64)
+#define LAS_SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define LAS_TARGET_AVX
+#else
+#define LAS_TARGET_AVX __attribute__((target("avx")))
+#endif
+#endif
 
 namespace LAS {
 
-    LasLoader::LasLoader(const std::string& path) : PointData{} {
+    // Below this many items per thread, starting threads costs more than it saves
+    constexpr size_t minItemsPerThread = 1 << 16;
+
+    static unsigned int ResolveThreadCount(unsigned int requested) {
+        if (requested != 0) {
+            return requested;
+        }
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Splits [0, count) into one contiguous range per thread (at least minPerThread items each) and runs fn(begin, end) on each
+    template<typename Fn>
+    static void ParallelFor(size_t count, unsigned int threadCount, size_t minPerThread, Fn&& fn) {
+        size_t threads = std::min<size_t>(ResolveThreadCount(threadCount), count / minPerThread);
+        if (threads <= 1) {
+            fn(size_t(0), count);
+            return;
+        }
+
+        std::vector<std::thread> workers;
+        workers.reserve(threads - 1);
+        size_t chunk = (count + threads - 1) / threads;
+        for (size_t begin = chunk; begin < count; begin += chunk) {
+            workers.emplace_back(fn, begin, std::min(begin + chunk, count));
+        }
+        fn(size_t(0), std::min(chunk, count));
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    static uint64_t SplitMix64(uint64_t value) {
+        value += 0x9E3779B97F4A7C15ull;
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+        return value ^ (value >> 31);
+    }
+
+    // LasPointFilter flattened into a lookup table, so each record costs a few byte loads
+    struct PointFilterTable {
+        explicit PointFilterTable(const LasPointFilter& filter)
+            : active(filter.IsActive()), firstReturns(filter.onlyFirstReturns), lastReturns(filter.onlyLastReturns),
+            dropWithheld(filter.dropWithheld), dropSynthetic(filter.dropSynthetic) {
+            std::fill(std::begin(keepClass), std::end(keepClass), filter.classifications.empty());
+            for (uint8_t classification : filter.classifications) {
+                keepClass[classification] = true;
+            }
+        }
+
+        // Null when every record passes, so decoders can skip the checks entirely
+        const PointFilterTable* Get() const { return active ? this : nullptr; }
+
+        template<uint8_t Format>
+        bool Accepts(const char* record) const {
+            using Layout = LasPointFormat<Format>;
+            const uint8_t returns = static_cast<uint8_t>(record[Layout::returnsOffset]);
+            uint8_t returnNumber, returnCount, classification;
+            bool withheld, synthetic;
+            if constexpr (Layout::extended) {
+                const uint8_t flags = static_cast<uint8_t>(record[15]);
+                returnNumber = returns & 0x0F;
+                returnCount = returns >> 4;
+                classification = static_cast<uint8_t>(record[Layout::classificationOffset]);
+                synthetic = (flags & 0x01) != 0;
+                withheld = (flags & 0x04) != 0;
+            }
+            else {
+                const uint8_t classByte = static_cast<uint8_t>(record[Layout::classificationOffset]);
+                returnNumber = returns & 0x07;
+                returnCount = (returns >> 3) & 0x07;
+                classification = classByte & 0x1F;
+                synthetic = (classByte & 0x20) != 0;
+                withheld = (classByte & 0x80) != 0;
+            }
+
+            if (!keepClass[classification] || (dropWithheld && withheld) || (dropSynthetic && synthetic)) {
+                return false;
+            }
+            if (firstReturns || lastReturns) {
+                // Writers that leave the return fields at 0 get their points treated as single returns
+                bool first = returnNumber <= 1;
+                bool last = returnNumber >= returnCount;
+                return (firstReturns && first) || (lastReturns && last);
+            }
+            return true;
+        }
+
+        bool Accepts(uint8_t format, const char* record) const {
+            switch (format) {
+            case 0: return Accepts<0>(record);
+            case 1: return Accepts<1>(record);
+            case 2: return Accepts<2>(record);
+            case 3: return Accepts<3>(record);
+            case 4: return Accepts<4>(record);
+            case 5: return Accepts<5>(record);
+            case 6: return Accepts<6>(record);
+            case 7: return Accepts<7>(record);
+            case 8: return Accepts<8>(record);
+            case 9: return Accepts<9>(record);
+            case 10: return Accepts<10>(record);
+            default: return false;
+            }
+        }
+
+        bool active;
+        bool firstReturns;
+        bool lastReturns;
+        bool dropWithheld;
+        bool dropSynthetic;
+        bool keepClass[256];
+    };
+
+    // Where decoded points go, either packed vertices or the columns of cloud starting at index first.
+    // firstRecord is the record index of the first decoded record, for LasChannelRecordIndex.
+    struct PointSink {
+        ColorVertex* vertices{ nullptr };
+        PointCloud* cloud{ nullptr };
+        size_t first{ 0 };
+        uint64_t firstRecord{ 0 };
+    };
+
+    static size_t DecodeBlock(const lasHeader& header, const char* records, size_t count, const PointFilterTable* filter, const PointSink& out, uint32_t* indices);
+
+    // Closes the gaps left by slices that were decoded in place at fixed offsets and then came up short
+    static void CompactSlices(PointCloud& points, const std::vector<size_t>& sliceFirst, const std::vector<size_t>& sliceKept) {
+        size_t write = 0;
+        for (size_t i = 0; i < sliceKept.size(); ++i) {
+            if (write != sliceFirst[i]) {
+                points.MoveDown(sliceFirst[i], write, sliceKept[i]);
+            }
+            write += sliceKept[i];
+        }
+        points.Resize(write);
+    }
+
+    // Decides which points survive decimation. Stride and random only look at the record index,
+    // so the same points are picked no matter how the file is split between threads or filtered.
+    class PointDecimator {
+
+    public:
+        explicit PointDecimator(const LoadSettings& settings) : settings(settings) {
+            if (settings.decimation == LasDecimateRandom) {
+                double fraction = std::clamp(double(settings.decimationFraction), 0.0, 1.0);
+                threshold = fraction >= 1.0 ? std::numeric_limits<uint64_t>::max() : static_cast<uint64_t>(fraction * 18446744073709551616.0);
+            }
+        }
+
+        bool IsActive() const { return settings.decimation != LasDecimateNone; }
+        bool UsesVoxels() const { return settings.decimation == LasDecimateVoxel && settings.voxelSize > 0.f; }
+
+        bool KeepIndex(uint64_t index) const {
+            switch (settings.decimation) {
+            case LasDecimateStride: return settings.decimationStride <= 1 || index % settings.decimationStride == 0;
+            case LasDecimateRandom: return SplitMix64(settings.decimationSeed ^ SplitMix64(index)) < threshold;
+            default: return true;
+            }
+        }
+
+        // 64 bit hash of the voxel a point is in, a collision only costs one point
+        uint64_t VoxelKey(const glm::vec3& pos) const {
+            uint64_t key = SplitMix64(static_cast<uint64_t>(static_cast<int64_t>(std::floor(pos.x / settings.voxelSize))));
+            key = SplitMix64(key ^ static_cast<uint64_t>(static_cast<int64_t>(std::floor(pos.y / settings.voxelSize))));
+            return SplitMix64(key ^ static_cast<uint64_t>(static_cast<int64_t>(std::floor(pos.z / settings.voxelSize))));
+        }
+    private:
+        const LoadSettings& settings;
+        uint64_t threshold{ 0 };
+    };
+
+    // Decodes count points in parallel, a batch at a time, and appends the ones the decimator keeps to out.
+    // decode(first, n, points, indices) decodes [first, first + n) of this call and returns how many passed the filter,
+    // indices[i] being the offset of points[i] from the start of this call. firstIndex is the record index of that start.
+    // Points that carry LasChannelRecordIndex are picked by that index instead. voxels holds the voxels already taken, so it carries over between calls for the same cloud.
+    template<typename DecodeFn>
+    static void DecodeSelected(const PointDecimator& decimator, uint64_t firstIndex, size_t count, unsigned int threadCount,
+        DecodeFn&& decode, PointCloud& out, std::unordered_set<uint64_t>& voxels) {
+
+        const size_t parts = std::max<size_t>(1, std::min<size_t>(ResolveThreadCount(threadCount), count / minItemsPerThread));
+        const size_t batchSize = std::min(count, lasBlockSize);
+        std::vector<PointCloud> kept(parts, PointCloud(out.Channels()));
+        ParallelFor(parts, threadCount, 1, [&](size_t beginPart, size_t endPart) {
+            PointCloud batch(out.Channels());
+            std::vector<uint32_t> indices(batchSize);
+            std::vector<uint32_t> selected;
+            std::unordered_set<uint64_t> seen;
+            for (size_t part = beginPart; part < endPart; ++part) {
+                size_t end = count * (part + 1) / parts;
+                for (size_t first = count * part / parts; first < end; first += batchSize) {
+                    batch.Resize(batchSize);
+                    size_t n = decode(first, std::min(batchSize, end - first), batch, indices.data());
+                    selected.clear();
+                    for (size_t i = 0; i < n; ++i) {
+                        uint64_t index = batch.Has(LasChannelRecordIndex) ? batch.RecordIndices[i] : firstIndex + first + indices[i];
+                        if (decimator.KeepIndex(index)
+                            && (!decimator.UsesVoxels() || seen.insert(decimator.VoxelKey(batch.Positions[i])).second)) {
+                            selected.push_back(static_cast<uint32_t>(i));
+                        }
+                    }
+                    kept[part].AppendSelected(batch, selected.data(), selected.size());
+                }
+            }
+        });
+
+        // Parts are joined in file order, so each voxel keeps its first point in the file
+        std::vector<uint32_t> selected;
+        for (auto& points : kept) {
+            if (!decimator.UsesVoxels()) {
+                out.Append(points);
+                points.Clear();
+                continue;
+            }
+            selected.clear();
+            for (size_t i = 0; i < points.Size(); ++i) {
+                if (voxels.insert(decimator.VoxelKey(points.Positions[i])).second) {
+                    selected.push_back(static_cast<uint32_t>(i));
+                }
+            }
+            out.AppendSelected(points, selected.data(), selected.size());
+            points.Clear();
+        }
+    }
+
+    // Bump when the cache layout or the processing that fills it changes
+    constexpr uint32_t terrainCacheVersion = 2;
+
+    struct terrainCacheHeader {
+        char signature[8];
+        uint32_t version;
+        uint32_t keyLength;
+        uint64_t vertexCount;
+        uint64_t colorNormalVertexCount;
+        uint64_t indexCount;
+        int32_t xSquares;
+        int32_t zSquares;
+        glm::vec3 min;
+        glm::vec3 max;
+        glm::vec3 middle;
+        glm::vec3 offset;
+    };
+
+    constexpr char terrainCacheSignature[8] = { 'L', 'A', 'S', 'C', 'A', 'C', 'H', 'E' };
+
+    static std::string HashToHex(const std::string& text) {
+        // 64 bit FNV-1a
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : text) {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+        return hex;
+    }
+
+    LasLoader::LasLoader(const std::string& path, const LoadSettings& settings) : settings(settings), PointData(settings.channels) {
+        Load({ path });
+    }
+
+    LasLoader::LasLoader(const std::string& path, const glm::dvec2& regionMin, const glm::dvec2& regionMax, const LoadSettings& settings)
+        : settings(settings), PointData(settings.channels), hasRegion(true), regionMin(glm::min(regionMin, regionMax)), regionMax(glm::max(regionMin, regionMax)) {
+        Load({ path });
+    }
+
+    LasLoader::LasLoader(const std::vector<std::string>& paths, const LoadSettings& settings) : settings(settings), PointData(settings.channels) {
+        Load(paths);
+    }
+
+    LasLoader::LasLoader(const std::string& path, const LoadSettings& settings, TileTag) : settings(settings), PointData(settings.channels) {
+        ReadTile(path);
+        FindMinMax();
+    }
+
+    void LasLoader::Load(const std::vector<std::string>& paths) {
+        sourcePaths = paths;
+
+        // A warm cache skips parsing and triangulation entirely
+        if (!settings.cacheDirectory.empty()) {
+            cacheKey = TerrainCacheKey(paths);
+            cachePath = settings.cacheDirectory + "/" + HashToHex(cacheKey) + ".lascache";
+            if (!cacheKey.empty() && LoadTerrainCache(cachePath, cacheKey)) {
+                cacheKey.clear();
+                centered = vertexDataBuilt = colorNormalVertexDataBuilt = indexDataBuilt = true;
+                skippedPaths = paths;
+                return;
+            }
+        }
+
+        // Only the points are read here, centering and the mesh wait until something asks for them
+        if (paths.size() == 1) {
+            ReadTile(paths[0]);
+        }
+        else {
+            ReadTiles(paths);
+        }
+    }
+
+    void LasLoader::ReadTile(const std::string& path) {
+        // Readers that filter or clip before decimating leave gaps, so the points carry their record index until then
+        if (PointDecimator(settings).IsActive()) {
+            PointData.SetChannels(settings.channels | LasChannelRecordIndex);
+        }
+        ReadPoints(path);
+        if (hasRegion) {
+            ClipToRegion();
+        }
+        DecimatePoints();
+        PointData.SetChannels(settings.channels);
+    }
+
+    void LasLoader::ReadTiles(const std::vector<std::string>& paths) {
+        if (paths.empty()) {
+            return;
+        }
+
+        // Each tile gets an equal share of the threads, the float points are needed to merge them
+        const size_t threads = ResolveThreadCount(settings.threadCount);
+        LoadSettings tileSettings = settings;
+        tileSettings.cacheDirectory.clear();
+        tileSettings.quantizedStorage = false;
+        tileSettings.threadCount = static_cast<unsigned int>(std::max<size_t>(1, threads / paths.size()));
+
+        // Tiles vary in size, so workers pull the next one as they finish instead of splitting the list up front
+        std::vector<std::unique_ptr<LasLoader>> tiles(paths.size());
+        std::atomic<size_t> nextTile{ 0 };
+        ParallelFor(std::min(threads, paths.size()), settings.threadCount, 1, [&](size_t, size_t) {
+            for (size_t i = nextTile++; i < paths.size(); i = nextTile++) {
+                tiles[i].reset(new LasLoader(paths[i], tileSettings, TileTag{}));
+            }
+        });
+
+        // The combined bounds give every tile the same origin, so they bin into one grid
+        size_t total = 0;
+        bool first = true;
+        for (const auto& tile : tiles) {
+            total += tile->PointData.Size();
+            if (tile->PointData.Empty()) {
+                continue;
+            }
+            min = first ? tile->min : glm::min(min, tile->min);
+            max = first ? tile->max : glm::max(max, tile->max);
+            first = false;
+        }
+        PointData.Reserve(total);
+        for (auto& tile : tiles) {
+            PointData.Append(tile->PointData);
+            tile.reset();
+        }
+
+        // Each tile keeps one point per voxel of its own, so a voxel across a tile edge still has one from each side.
+        // A second pass over the merged points keeps the first of those, as if the tiles were one file.
+        if (PointDecimator(settings).UsesVoxels()) {
+            DecimatePoints();
+        }
+    }
+
+    void LasLoader::ReadPoints(const std::string& path) {
 
         std::string txt(".txt");
         std::string lasbin(".lasbin");
         std::string las(".las");
+        std::string laz(".laz");
 
         if (path.find(txt) != std::string::npos)
             ReadTxt(path);
@@ -21,17 +421,45 @@ namespace LAS {
             ReadBin(path);
         else if (path.find(las) != std::string::npos)
             ReadLas(path);
-        // TODO: Dont calc center when reading .las (already in header)
+        else if (path.find(laz) != std::string::npos)
+            ReadLaz(path);
+    }
 
-        CalcCenter();
-        UpdatePoints();
-        Triangulate();
+    // Visits every point, dequantizing the quantized store a batch at a time so it never exists as floats
+    template<typename Fn>
+    void LasLoader::ForEachPoint(Fn&& fn) const {
+        ForEachPoint(0, PointCount(), fn);
     }
 
-    std::vector<ColorVertex> LasLoader::GetPointData() {
-        return LasLoader::PointData;
+    // Visits points [begin, end) in order
+    template<typename Fn>
+    void LasLoader::ForEachPoint(size_t begin, size_t end, Fn&& fn) const {
+        if (QuantizedPoints.Empty()) {
+            for (size_t i = begin; i < end; ++i) {
+                fn(PointData.Positions[i], PointData.Colors[i]);
+            }
+            return;
+        }
+        std::vector<ColorVertex> batch(std::min(end - begin, lasBlockSize));
+        for (size_t first = begin; first < end; first += batch.size()) {
+            size_t n = std::min(batch.size(), end - first);
+            QuantizedPoints.Decode(first, n, batch.data());
+            for (size_t i = 0; i < n; ++i) {
+                fn(batch[i].Pos, batch[i].Color);
+            }
+        }
     }
 
+    std::vector<ColorVertex> LasLoader::GetPointData() {
+        PreparePoints();
+        if (!QuantizedPoints.Empty()) {
+            std::vector<ColorVertex> points;
+            points.reserve(QuantizedPoints.Size());
+            ForEachPoint([&](const glm::vec3& pos, const glm::vec3& color) { points.push_back({ pos, color }); });
+            return points;
+        }
+        return PointData.ToVertices();
+    }
 
     void LasLoader::FindMinMax() {
 
@@ -42,14 +470,54 @@ namespace LAS {
         min = glm::vec3(std::numeric_limits<float>::max());
         max = glm::vec3(std::numeric_limits<float>::min());
 
-        for (auto& vertex : PointData) {
-            if (min.x > vertex.Pos.x) { min.x = vertex.Pos.x; }
-            else if (max.x < vertex.Pos.x) { max.x = vertex.Pos.x; }
-            if (min.z > vertex.Pos.z) { min.z = vertex.Pos.z; }
-            else if (max.z < vertex.Pos.z) { max.z = vertex.Pos.z; }
-            if (min.y > vertex.Pos.y) { min.y = vertex.Pos.y; }
-            else if (max.y < vertex.Pos.y) { max.y = vertex.Pos.y; }
+        ForEachPoint([&](const glm::vec3& pos, const glm::vec3&) {
+            if (min.x > pos.x) { min.x = pos.x; }
+            else if (max.x < pos.x) { max.x = pos.x; }
+            if (min.z > pos.z) { min.z = pos.z; }
+            else if (max.z < pos.z) { max.z = pos.z; }
+            if (min.y > pos.y) { min.y = pos.y; }
+            else if (max.y < pos.y) { max.y = pos.y; }
+        });
+    }
+
+    void LasLoader::PreparePoints() {
+        if (!skippedPaths.empty()) {
+            // Reading sets the bounds again, but the cached ones already describe the centered points
+            std::vector<std::string> paths = std::exchange(skippedPaths, {});
+            glm::vec3 cachedMin = min;
+            glm::vec3 cachedMax = max;
+            if (paths.size() == 1) {
+                ReadTile(paths[0]);
+            }
+            else {
+                ReadTiles(paths);
+            }
+            min = cachedMin;
+            max = cachedMax;
+            UpdatePoints();
+        }
+        Center();
+    }
+
+    PointCloud LasLoader::TakePointCloud() {
+        PreparePoints();
+
+        // The points are left to be read again like after a warm cache load, so a later mesh still has them.
+        // A quantized store keeps the points and only an empty cloud is handed over.
+        if (!PointData.Empty()) {
+            skippedPaths = sourcePaths;
+        }
+        return std::exchange(PointData, PointCloud(settings.channels));
+    }
+
+    void LasLoader::Center() {
+        if (centered) {
+            return;
         }
+        // TODO: Dont calc center when reading .las (already in header)
+        CalcCenter();
+        UpdatePoints();
+        centered = true;
     }
 
     void LasLoader::CalcCenter() {
@@ -67,61 +535,55 @@ namespace LAS {
 
     void LasLoader::UpdatePoints() {
 
-        for (auto& vertex : PointData) {
+        // Quantized points are moved as they are decoded instead of one by one here
+        if (!QuantizedPoints.Empty()) {
+            if (middle != glm::vec3(0.f))
+                QuantizedPoints.SetShift(offset);
+            return;
+        }
+        for (auto& pos : PointData.Positions) {
             if (middle != glm::vec3(0.f))
-                vertex.Pos -= offset;
+                pos -= offset;
         }
     }
 
     void LasLoader::Triangulate() {
+        if (triangulated || RestoreGrid()) {
+            return;
+        }
+        PreparePoints();
 
-        // width and height
-        xSquares = (max.x - min.x);
-        zSquares = (max.z - min.z);
+        // width and height, in cells
+        xSquares = (max.x - min.x) / CellSize();
+        zSquares = (max.z - min.z) / CellSize();
 
         // Save all height data for each vertex
-        std::vector<std::vector<HeightAndColor>> heightmap(zSquares, std::vector<HeightAndColor>(xSquares));
-        for (auto& vertex : PointData) {
-            int xPos = vertex.Pos.x;
-            int zPos = vertex.Pos.z;
-
-            if (xPos < 0.f || xPos > xSquares - 1
-                || zPos < 0.f || zPos > zSquares - 1) {
-                continue;
-            }
-
-            // Instead of push back, add height and increment
-            heightmap[zPos][xPos].count++;
-            heightmap[zPos][xPos].sum += vertex.Pos.y;
-            heightmap[zPos][xPos].color += vertex.Color;
-        }
+        Grid2D<HeightAndColor> heightmap(xSquares, zSquares);
+        BinPoints(heightmap);
 
         std::vector<std::pair<int, int>> noHeight;
 
-        // Calculate average height for each vertex and push
+        // Calculate average height for each vertex
+        gridHeights.Reset(xSquares, zSquares);
+        gridColors.Reset(xSquares, zSquares);
         for (int z = 0; z < zSquares; ++z) {
+            const HeightAndColor* cells = heightmap.Row(z);
+            float* heights = gridHeights.Row(z);
+            glm::vec3* colors = gridColors.Row(z);
             for (int x = 0; x < xSquares; ++x) {
-                float y;
-                glm::vec3 color{};
-                if (heightmap[z][x].count == 0) {
-                    y = -max.y;
+                if (cells[x].count == 0) {
+                    heights[x] = -max.y;
+                    colors[x] = glm::vec3(1.f);
                     noHeight.push_back(std::make_pair(x, z));
-                    color = glm::vec3(1.f);
                 }
                 else {
                     //y = (average / count) - max.y;
-                    y = heightmap[z][x].sum / heightmap[z][x].count - max.y;
-                    color = heightmap[z][x].color / glm::vec3(heightmap[z][x].count);
+                    heights[x] = cells[x].sum / cells[x].count - max.y;
+                    colors[x] = cells[x].color / glm::vec3(cells[x].count);
                 }
-                MeshVertex temp{};
-                ColorNormalVertex temp2{};
-                temp.Pos = glm::vec3(x, y, z);
-                temp2.Pos = temp.Pos;
-                temp2.Color = color;
-                VertexData.push_back(temp);
-                ColorNormalVertexData.push_back(temp2);
             }
         }
+        heightmap.Clear();
 
         // Calculate average height if no height
         for (auto& vertex : noHeight) {
@@ -132,85 +594,416 @@ namespace LAS {
             }
             else {
                 float averageHeight{ 0.f };
-                averageHeight += VertexData[(x - 1) + (z * xSquares)].Pos.y;
-                averageHeight += VertexData[(x - 1) + ((z - 1) * xSquares)].Pos.y;
-                averageHeight += VertexData[x + ((z - 1) * xSquares)].Pos.y;
-                averageHeight += VertexData[(x + 1) + ((z - 1) * xSquares)].Pos.y;
-                averageHeight += VertexData[(x + 1) + (z * xSquares)].Pos.y;
-                averageHeight += VertexData[(x + 1) + ((z + 1) * xSquares)].Pos.y;
-                averageHeight += VertexData[x + ((z + 1) * xSquares)].Pos.y;
-                averageHeight += VertexData[(x - 1) + ((z + 1) * xSquares)].Pos.y;
+                averageHeight += gridHeights(x - 1, z);
+                averageHeight += gridHeights(x - 1, z - 1);
+                averageHeight += gridHeights(x, z - 1);
+                averageHeight += gridHeights(x + 1, z - 1);
+                averageHeight += gridHeights(x + 1, z);
+                averageHeight += gridHeights(x + 1, z + 1);
+                averageHeight += gridHeights(x, z + 1);
+                averageHeight += gridHeights(x - 1, z + 1);
 
                 glm::vec3 averageColor{};
-                averageColor += ColorNormalVertexData[(x - 1) + (z * xSquares)].Color;
-                averageColor += ColorNormalVertexData[(x - 1) + ((z - 1) * xSquares)].Color;
-                averageColor += ColorNormalVertexData[x + ((z - 1) * xSquares)].Color;
-                averageColor += ColorNormalVertexData[(x + 1) + ((z - 1) * xSquares)].Color;
-                averageColor += ColorNormalVertexData[(x + 1) + (z * xSquares)].Color;
-                averageColor += ColorNormalVertexData[(x + 1) + ((z + 1) * xSquares)].Color;
-                averageColor += ColorNormalVertexData[x + ((z + 1) * xSquares)].Color;
-                averageColor += ColorNormalVertexData[(x - 1) + ((z + 1) * xSquares)].Color;
+                averageColor += gridColors(x - 1, z);
+                averageColor += gridColors(x - 1, z - 1);
+                averageColor += gridColors(x, z - 1);
+                averageColor += gridColors(x + 1, z - 1);
+                averageColor += gridColors(x + 1, z);
+                averageColor += gridColors(x + 1, z + 1);
+                averageColor += gridColors(x, z + 1);
+                averageColor += gridColors(x - 1, z + 1);
+
+                gridHeights(x, z) = averageHeight / 8.f;
+                gridColors(x, z) = averageColor / 8.f;
+            }
+        }
+        triangulated = true;
+    }
+
+    // The cache stores the whole mesh, so after a cache miss the first mesh output to be built
+    // brings the others along and writes them all
+    void LasLoader::SavePendingCache() {
+        if (cacheKey.empty()) {
+            return;
+        }
+        std::string key = std::exchange(cacheKey, {});
+        BuildVertexData();
+        BuildColorNormalVertexData();
+        BuildIndexData();
+        SaveTerrainCache(cachePath, key);
+    }
+
+    // Two triangles per cell of a width x height vertex grid
+    template<typename Index>
+    static void AppendGridIndices(int width, int height, std::vector<Index>& indices) {
+        indices.reserve(indices.size() + static_cast<size_t>(std::max(width - 1, 0)) * std::max(height - 1, 0) * 6);
+        for (int z = 0; z < height - 1; ++z) {
+            for (int x = 0; x < width - 1; ++x) {
+                indices.emplace_back(x + (width * z));
+                indices.emplace_back(x + 1 + (width * (z + 1)));
+                indices.emplace_back(x + 1 + (width * z));
+
+                indices.emplace_back(x + (width * z));
+                indices.emplace_back(x + (width * (z + 1)));
+                indices.emplace_back(x + 1 + (width * (z + 1)));
+            }
+        }
+    }
+
+    // Grid cell a point falls in, false if it lies outside the grid
+    static bool CellOf(const glm::vec3& pos, float cellSize, int xSquares, int zSquares, int& xPos, int& zPos) {
+        xPos = pos.x / cellSize;
+        zPos = pos.z / cellSize;
+        return !(xPos < 0.f || xPos > xSquares - 1
+            || zPos < 0.f || zPos > zSquares - 1);
+    }
+
+    static void AddToCell(HeightAndColor& cell, const glm::vec3& pos, const glm::vec3& color) {
+        // Instead of push back, add height and increment
+        cell.count++;
+        cell.sum += pos.y;
+        cell.color += color;
+    }
+
+    // Splits the grid into bands of rows and gives each band to one thread. Point indices are first
+    // bucketed by band with a stable counting sort, so every cell still adds up its points in file order
+    // and the sums match a single threaded pass bit for bit, whatever the thread count.
+    void LasLoader::BinPoints(Grid2D<HeightAndColor>& heightmap) const {
+        const size_t count = PointCount();
+        const size_t threads = ResolveThreadCount(settings.threadCount);
+        const size_t chunks = std::max<size_t>(1, std::min(threads, count / minItemsPerThread));
+        const float cellSize = CellSize();
+        if (chunks == 1 || count > std::numeric_limits<uint32_t>::max() || zSquares <= 0) {
+            ForEachPoint([&](const glm::vec3& pos, const glm::vec3& color) {
+                int x, z;
+                if (CellOf(pos, cellSize, xSquares, zSquares, x, z)) {
+                    AddToCell(heightmap(x, z), pos, color);
+                }
+            });
+            return;
+        }
+
+        // A few bands per thread evens out dense and sparse parts of the tile
+        const size_t bands = std::min<size_t>(threads * 4, static_cast<size_t>(zSquares));
+        auto bandOf = [&](int row) { return static_cast<size_t>(row) * bands / static_cast<size_t>(zSquares); };
+
+        // Points per band in each chunk of the point list
+        std::vector<size_t> offsets(chunks * bands, 0);
+        ParallelFor(chunks, settings.threadCount, 1, [&](size_t beginChunk, size_t endChunk) {
+            for (size_t chunk = beginChunk; chunk < endChunk; ++chunk) {
+                size_t* bandCounts = offsets.data() + chunk * bands;
+                ForEachPoint(count * chunk / chunks, count * (chunk + 1) / chunks, [&](const glm::vec3& pos, const glm::vec3&) {
+                    int x, z;
+                    if (CellOf(pos, cellSize, xSquares, zSquares, x, z)) {
+                        bandCounts[bandOf(z)]++;
+                    }
+                });
+            }
+        });
 
-                VertexData[x + (z * xSquares)].Pos.y = averageHeight / 8.f;
-                ColorNormalVertexData[x + (z * xSquares)].Pos.y = averageHeight / 8.f;
-                ColorNormalVertexData[x + (z * xSquares)].Color = averageColor / 8.f;
+        // Band major prefix sum, chunk by chunk within a band keeps the file order
+        std::vector<size_t> bandFirst(bands + 1, 0);
+        size_t total = 0;
+        for (size_t band = 0; band < bands; ++band) {
+            bandFirst[band] = total;
+            for (size_t chunk = 0; chunk < chunks; ++chunk) {
+                size_t n = offsets[chunk * bands + band];
+                offsets[chunk * bands + band] = total;
+                total += n;
             }
         }
+        bandFirst[bands] = total;
+
+        std::vector<uint32_t> order(total);
+        ParallelFor(chunks, settings.threadCount, 1, [&](size_t beginChunk, size_t endChunk) {
+            for (size_t chunk = beginChunk; chunk < endChunk; ++chunk) {
+                size_t* next = offsets.data() + chunk * bands;
+                size_t index = count * chunk / chunks;
+                ForEachPoint(index, count * (chunk + 1) / chunks, [&](const glm::vec3& pos, const glm::vec3&) {
+                    int x, z;
+                    if (CellOf(pos, cellSize, xSquares, zSquares, x, z)) {
+                        order[next[bandOf(z)]++] = static_cast<uint32_t>(index);
+                    }
+                    ++index;
+                });
+            }
+        });
+
+        // Bands cover disjoint rows, so no two threads touch the same cell. Workers pull the next band
+        // as they finish, since dense bands take longer.
+        std::atomic<size_t> nextBand{ 0 };
+        ParallelFor(std::min(threads, bands), settings.threadCount, 1, [&](size_t, size_t) {
+            std::vector<ColorVertex> batch(QuantizedPoints.Empty() ? 0 : lasBlockSize);
+            int x, z;
+            for (size_t band = nextBand++; band < bands; band = nextBand++) {
+                if (QuantizedPoints.Empty()) {
+                    for (size_t i = bandFirst[band]; i < bandFirst[band + 1]; ++i) {
+                        const glm::vec3& pos = PointData.Positions[order[i]];
+                        CellOf(pos, cellSize, xSquares, zSquares, x, z);
+                        AddToCell(heightmap(x, z), pos, PointData.Colors[order[i]]);
+                    }
+                    continue;
+                }
+                // Quantized points are dequantized a batch at a time, gathered in the order the band adds them
+                for (size_t first = bandFirst[band]; first < bandFirst[band + 1]; first += batch.size()) {
+                    size_t n = std::min(batch.size(), bandFirst[band + 1] - first);
+                    QuantizedPoints.Decode(order.data() + first, n, batch.data());
+                    for (size_t i = 0; i < n; ++i) {
+                        CellOf(batch[i].Pos, cellSize, xSquares, zSquares, x, z);
+                        AddToCell(heightmap(x, z), batch[i].Pos, batch[i].Color);
+                    }
+                }
+            }
+        });
+    }
+
+    // Smooth normal of an inner grid vertex, from the six triangles around it
+    static glm::vec3 GridNormal(const Grid2D<float>& heights, float spacing, int x, int z) {
+        auto vertex = [&](int vx, int vz) { return glm::vec3(vx * spacing, heights(vx, vz), vz * spacing); };
+        glm::vec3 a(vertex(x, z));
+        glm::vec3 b(vertex(x + 1, z));
+        glm::vec3 c(vertex(x + 1, z + 1));
+        glm::vec3 d(vertex(x, z + 1));
+        glm::vec3 e(vertex(x - 1, z));
+        glm::vec3 f(vertex(x - 1, z - 1));
+        glm::vec3 g(vertex(x, z - 1));
 
-        // Create Index
-        for (int z = 0; z < zSquares - 1; ++z) {
-            for (int x = 0; x < xSquares - 1; ++x) {
-                IndexData.emplace_back(x + (xSquares * z));
-                IndexData.emplace_back(x + 1 + (xSquares * (z + 1)));
-                IndexData.emplace_back(x + 1 + (xSquares * z));
+        auto n0 = glm::cross(c - a, b - a);
+        auto n1 = glm::cross(d - a, c - a);
+        auto n2 = glm::cross(e - a, d - a);
+        auto n3 = glm::cross(f - a, e - a);
+        auto n4 = glm::cross(g - a, f - a);
+        auto n5 = glm::cross(b - a, g - a);
+
+        glm::vec3 normal = n0 + n1 + n2 + n3 + n4 + n5;
+        return glm::normalize(normal);
+    }
+
+    void LasLoader::BuildVertexData() {
+        if (vertexDataBuilt) {
+            return;
+        }
+        Triangulate();
 
-                IndexData.emplace_back(x + (xSquares * z));
-                IndexData.emplace_back(x + (xSquares * (z + 1)));
-                IndexData.emplace_back(x + 1 + (xSquares * (z + 1)));
+        // Edge vertices point straight up
+        VertexData.assign(gridHeights.Size(), MeshVertex{});
+        for (int z = 0; z < zSquares; z++) {
+            for (int x = 0; x < xSquares; x++) {
+                MeshVertex& vertex = VertexData[x + (xSquares * z)];
+                vertex.Pos = GridPosition(x, z, gridHeights(x, z));
+                if (z == 0 || z == zSquares - 1 || x == 0 || x == xSquares - 1) {
+                    vertex.Normal = glm::vec3(0.f, 1.f, 0.f);
+                }
+                else {
+                    vertex.Normal = GridNormal(gridHeights, CellSize(), x, z);
+                }
             }
         }
+        vertexDataBuilt = true;
+        ReleaseGrid();
+        SavePendingCache();
+    }
 
-        // Calculate smooth normals
-        int xmin = 0, xmax = xSquares, zmin = 0, zmax = zSquares; // The size to draw
+    void LasLoader::BuildColorNormalVertexData() {
+        if (colorNormalVertexDataBuilt) {
+            return;
+        }
+        Triangulate();
 
-        // Normals for rest
-        for (int z = zmin; z < zmax; z++) {
-            for (int x = xmin; x < xmax; x++) {
-                if (z == zmin || z == zmax - 1 || x == xmin || x == xmax - 1) {
-                    VertexData[x + (xmax * z)].Normal = glm::vec3(0.f, 1.f, 0.f);
+        ColorNormalVertexData.assign(gridHeights.Size(), ColorNormalVertex{});
+        for (int z = 0; z < zSquares; z++) {
+            for (int x = 0; x < xSquares; x++) {
+                ColorNormalVertex& vertex = ColorNormalVertexData[x + (xSquares * z)];
+                vertex.Pos = GridPosition(x, z, gridHeights(x, z));
+                vertex.Color = gridColors(x, z);
+                if (z == 0 || z == zSquares - 1 || x == 0 || x == xSquares - 1) {
+                    vertex.Normal = glm::vec3(0.f, 1.f, 0.f);
                 }
                 else {
-                    glm::vec3 a(VertexData[x + (xmax * z)].Pos);
-                    glm::vec3 b(VertexData[x + 1 + (xmax * z)].Pos);
-                    glm::vec3 c(VertexData[x + 1 + (xmax * (z + 1))].Pos);
-                    glm::vec3 d(VertexData[x + (xmax * (z + 1))].Pos);
-                    glm::vec3 e(VertexData[x - 1 + (xmax * z)].Pos);
-                    glm::vec3 f(VertexData[x - 1 + (xmax * (z - 1))].Pos);
-                    glm::vec3 g(VertexData[x + (xmax * (z - 1))].Pos);
+                    vertex.Normal = GridNormal(gridHeights, CellSize(), x, z);
+                }
+            }
+        }
+        colorNormalVertexDataBuilt = true;
+        ReleaseGrid();
+        SavePendingCache();
+    }
+
+    void LasLoader::BuildIndexData() {
+        if (indexDataBuilt) {
+            return;
+        }
+        // The grid size is all the indices need, and it stays known once the grid has been built or restored
+        if (xSquares <= 0 || zSquares <= 0) {
+            Triangulate();
+        }
+        AppendGridIndices(xSquares, zSquares, IndexData);
+        indexDataBuilt = true;
+        SavePendingCache();
+    }
+
+    // Colored vertex (x, z) of a grid, edge vertices point straight up
+    static ColorNormalVertex GridVertex(const Grid2D<float>& heights, const Grid2D<glm::vec3>& colors, float spacing, int x, int z) {
+        ColorNormalVertex vertex;
+        vertex.Pos = glm::vec3(x * spacing, heights(x, z), z * spacing);
+        vertex.Color = colors(x, z);
+        if (z == 0 || z == heights.Height() - 1 || x == 0 || x == heights.Width() - 1) {
+            vertex.Normal = glm::vec3(0.f, 1.f, 0.f);
+        }
+        else {
+            vertex.Normal = GridNormal(heights, spacing, x, z);
+        }
+        return vertex;
+    }
+
+    // Next pyramid level, every second vertex of src. Each one is a 1-2-1 tent filtered average of its
+    // neighbours, so detail between the kept vertices is averaged in instead of skipped. An even sized
+    // side gets one more vertex clamped to the last one of src, so every level reaches the far edge.
+    template<typename T>
+    static Grid2D<T> HalveGrid(const Grid2D<T>& src) {
+        Grid2D<T> dst(src.Width() / 2 + 1, src.Height() / 2 + 1);
+        for (int z = 0; z < dst.Height(); ++z) {
+            for (int x = 0; x < dst.Width(); ++x) {
+                const int srcX = std::min(x * 2, src.Width() - 1);
+                const int srcZ = std::min(z * 2, src.Height() - 1);
+                T sum(0.f);
+                float weight = 0.f;
+                for (int dz = -1; dz <= 1; ++dz) {
+                    for (int dx = -1; dx <= 1; ++dx) {
+                        if (src.Contains(srcX + dx, srcZ + dz)) {
+                            float w = static_cast<float>((2 - std::abs(dx)) * (2 - std::abs(dz)));
+                            sum += src(srcX + dx, srcZ + dz) * w;
+                            weight += w;
+                        }
+                    }
+                }
+                dst(x, z) = sum / weight;
+            }
+        }
+        return dst;
+    }
+
+    void LasLoader::BuildTerrainLods() {
+        if (terrainLodsBuilt) {
+            return;
+        }
+        Triangulate();
+
+        // Each level is filtered down from the one before, so the base grid is only read once
+        const int maxLevels = settings.lodLevels > 0 ? settings.lodLevels : std::numeric_limits<int>::max();
+        Grid2D<float> heights;
+        Grid2D<glm::vec3> colors;
+        float spacing = CellSize();
+        // A clamped last row or column sits at the edge of the full grid, not a whole spacing further out
+        const float extentX = (gridHeights.Width() - 1) * CellSize();
+        const float extentZ = (gridHeights.Height() - 1) * CellSize();
+        for (int level = 0; level < maxLevels; ++level) {
+            const Grid2D<float>& levelHeights = level == 0 ? gridHeights : heights;
+            const Grid2D<glm::vec3>& levelColors = level == 0 ? gridColors : colors;
 
-                    auto n0 = glm::cross(c - a, b - a);
-                    auto n1 = glm::cross(d - a, c - a);
-                    auto n2 = glm::cross(e - a, d - a);
-                    auto n3 = glm::cross(f - a, e - a);
-                    auto n4 = glm::cross(g - a, f - a);
-                    auto n5 = glm::cross(b - a, g - a);
+            TerrainLod& lod = TerrainLods.emplace_back();
+            lod.width = levelHeights.Width();
+            lod.height = levelHeights.Height();
+            lod.spacing = spacing;
+            lod.Vertices.resize(levelHeights.Size());
+            for (int z = 0; z < lod.height; ++z) {
+                for (int x = 0; x < lod.width; ++x) {
+                    ColorNormalVertex& vertex = lod.Vertices[x + (lod.width * z)];
+                    vertex = GridVertex(levelHeights, levelColors, spacing, x, z);
+                    vertex.Pos.x = std::min(vertex.Pos.x, extentX);
+                    vertex.Pos.z = std::min(vertex.Pos.z, extentZ);
+                }
+            }
+            AppendGridIndices(lod.width, lod.height, lod.Indices);
+
+            // Stop once a side is down to 2 vertices, halving again would leave nothing to triangulate
+            if (lod.width <= 2 || lod.height <= 2) {
+                break;
+            }
+            heights = HalveGrid(levelHeights);
+            colors = HalveGrid(levelColors);
+            spacing *= 2.f;
+        }
+        terrainLodsBuilt = true;
+        ReleaseGrid();
+        SavePendingCache();
+    }
+
+    void LasLoader::BuildTerrainChunks() {
+        if (terrainChunksBuilt) {
+            return;
+        }
+        Triangulate();
 
-                    glm::vec3 normal = n0 + n1 + n2 + n3 + n4 + n5;
-                    normal = glm::normalize(normal);
+        // Chunks are counted in cells, the last one in a row or column may be smaller
+        const int chunkSize = std::clamp(settings.chunkSize, 1, maxTerrainChunkSize);
+        const int cellsX = std::max(xSquares - 1, 0);
+        const int cellsZ = std::max(zSquares - 1, 0);
+        const int chunksX = (cellsX + chunkSize - 1) / chunkSize;
+        const int chunksZ = (cellsZ + chunkSize - 1) / chunkSize;
+        TerrainChunks.resize(static_cast<size_t>(chunksX) * chunksZ);
+        ParallelFor(TerrainChunks.size(), settings.threadCount, 64, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                TerrainChunk& chunk = TerrainChunks[i];
+                chunk.cellX = static_cast<int>(i % chunksX) * chunkSize;
+                chunk.cellZ = static_cast<int>(i / chunksX) * chunkSize;
+                chunk.width = std::min(chunkSize, cellsX - chunk.cellX);
+                chunk.height = std::min(chunkSize, cellsZ - chunk.cellZ);
 
-                    VertexData[x + (xmax * z)].Normal = normal;
-                    ColorNormalVertexData[x + (xmax * z)].Normal = normal;
+                // The edge row and column are copied into the neighbours too, with normals from the whole grid
+                chunk.Vertices.resize(static_cast<size_t>(chunk.width + 1) * (chunk.height + 1));
+                chunk.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+                chunk.boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+                for (int z = 0; z <= chunk.height; ++z) {
+                    for (int x = 0; x <= chunk.width; ++x) {
+                        ColorNormalVertex& vertex = chunk.Vertices[x + ((chunk.width + 1) * z)];
+                        vertex = GridVertex(gridHeights, gridColors, CellSize(), chunk.cellX + x, chunk.cellZ + z);
+                        chunk.boundsMin = glm::min(chunk.boundsMin, vertex.Pos);
+                        chunk.boundsMax = glm::max(chunk.boundsMax, vertex.Pos);
+                    }
                 }
+                AppendGridIndices(chunk.width + 1, chunk.height + 1, chunk.Indices);
             }
+        });
+        terrainChunksBuilt = true;
+        ReleaseGrid();
+        SavePendingCache();
+    }
+
+    // Once both vertex layouts exist the grid is dropped, the color layout holds the same heights and colors
+    bool LasLoader::RestoreGrid() {
+        if (!colorNormalVertexDataBuilt || xSquares <= 0 || zSquares <= 0
+            || ColorNormalVertexData.size() != static_cast<size_t>(xSquares) * zSquares) {
+            return false;
         }
+        gridHeights.Reset(xSquares, zSquares);
+        gridColors.Reset(xSquares, zSquares);
+        for (size_t i = 0; i < ColorNormalVertexData.size(); ++i) {
+            gridHeights.Data()[i] = ColorNormalVertexData[i].Pos.y;
+            gridColors.Data()[i] = ColorNormalVertexData[i].Color;
+        }
+        triangulated = true;
+        return true;
     }
 
+    // The grid is only needed to build the vertex layouts, so it goes once both exist
+    void LasLoader::ReleaseGrid() {
+        if (vertexDataBuilt && colorNormalVertexDataBuilt) {
+            gridHeights.Clear();
+            gridColors.Clear();
+            triangulated = false;
+        }
+    }
 
     std::pair<std::vector<MeshVertex>, std::vector<uint32_t>> LasLoader::GetIndexedData() {
+        BuildVertexData();
+        BuildIndexData();
         return { LasLoader::VertexData, LasLoader::IndexData };
     }
 
     std::vector<MeshVertex> LasLoader::GetVertexData() {
+        BuildVertexData();
+        BuildIndexData();
         std::vector<MeshVertex> out;
         int i = 0;
         while (i != IndexData.size()) {
@@ -249,13 +1042,16 @@ namespace LAS {
     }
 
     std::pair<std::vector<ColorNormalVertex>, std::vector<uint32_t>> LasLoader::GetIndexedColorNormalVertexData() {
+        BuildColorNormalVertexData();
+        BuildIndexData();
         return { ColorNormalVertexData, IndexData };
     }
 
     std::vector<std::vector<std::pair<Triangle, Triangle>>> LasLoader::GetTerrainData() {
+        BuildVertexData();
 
-        int width = (max.x - min.x);
-        int height = (max.z - min.z);
+        int width = xSquares;
+        int height = zSquares;
 
         std::vector<std::vector<std::pair<Triangle, Triangle>>> out(height - 1,
             std::vector<std::pair<Triangle, Triangle>>(width - 1));
@@ -287,140 +1083,3075 @@ namespace LAS {
         return out;
     }
 
-    void LasLoader::ReadTxt(const std::string& path) {
-        std::ifstream file(path);
+    static bool IsTxtSeparator(char c) {
+        return c == ' ' || c == '\t' || c == ',' || c == ';';
+    }
 
-        if (!file.is_open()) {
+    // Parses "x y z" lines (las axis order) in [cur, end), skipping lines that don't start with three numbers
+    static void ParseTxtLines(const char* cur, const char* end, std::vector<ColorVertex>& out) {
+        // Roughly the shortest line a survey export writes
+        out.reserve(static_cast<size_t>(end - cur) / 24);
+        while (cur < end) {
+            const char* lineEnd = static_cast<const char*>(std::memchr(cur, '\n', static_cast<size_t>(end - cur)));
+            if (lineEnd == nullptr) {
+                lineEnd = end;
+            }
+
+            float values[3];
+            bool valid = true;
+            const char* p = cur;
+            for (int i = 0; i < 3 && valid; ++i) {
+                while (p < lineEnd && IsTxtSeparator(*p)) {
+                    ++p;
+                }
+                auto result = std::from_chars(p, lineEnd, values[i]);
+                valid = result.ec == std::errc();
+                p = result.ptr;
+            }
+
+            if (valid) {
+                ColorVertex tempVertex{};
+                tempVertex.Pos = glm::vec3(values[0], values[2], values[1]);
+                tempVertex.Color = glm::vec3(0.f, 1.f, 0.f);
+                out.push_back(tempVertex);
+            }
+            cur = lineEnd + 1;
+        }
+    }
+
+    void LasLoader::ReadTxt(const std::string& path) {
+        MappedFile file(path);
+        if (!file.IsOpen()) {
             std::cout << "Cant open file: " << path << std::endl;
             return;
         }
-        std::string line;
-        ColorVertex tempVertex{};
-        while (std::getline(file, line)) {
-            std::stringstream ss(line);
-            ss >> tempVertex.Pos.x;
-            ss >> tempVertex.Pos.z;
-            ss >> tempVertex.Pos.y;
-            tempVertex.Color = glm::vec3(0.f, 1.f, 0.f);
-            PointData.push_back(tempVertex);
+
+        // Split the file into line aligned chunks that are parsed independently
+        constexpr size_t minChunkBytes = 1 << 20;
+        const char* begin = file.Data();
+        const char* end = begin + file.Size();
+        size_t chunkCount = std::max<size_t>(1, std::min<size_t>(ResolveThreadCount(settings.threadCount), file.Size() / minChunkBytes));
+        std::vector<const char*> bounds{ begin };
+        for (size_t i = 1; i < chunkCount; ++i) {
+            const char* split = std::max(bounds.back(), begin + file.Size() * i / chunkCount);
+            const char* newline = static_cast<const char*>(std::memchr(split, '\n', static_cast<size_t>(end - split)));
+            bounds.push_back(newline != nullptr ? newline + 1 : end);
+        }
+        bounds.push_back(end);
+
+        std::vector<std::vector<ColorVertex>> parts(chunkCount);
+        ParallelFor(chunkCount, settings.threadCount, 1, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                ParseTxtLines(bounds[i], bounds[i + 1], parts[i]);
+            }
+        });
+
+        size_t total = 0;
+        for (auto& part : parts) {
+            total += part.size();
+        }
+        PointData.Reserve(total);
+        for (auto& part : parts) {
+            PointData.Append(part.data(), part.size());
+            std::vector<ColorVertex>().swap(part);
+        }
+        if (PointData.Has(LasChannelRecordIndex)) {
+            std::iota(PointData.RecordIndices.begin(), PointData.RecordIndices.end(), 0ull);
         }
     }
 
     void LasLoader::ReadBin(const std::string& path) {
 
         std::ifstream is(path, std::ios::binary | std::ios::ate);
-        auto size = is.tellg();
-        std::vector<glm::vec3> lasDataPoints(size / sizeof(glm::vec3));
+        if (!is.is_open()) {
+            std::cout << "Cant open file: " << path << std::endl;
+            return;
+        }
+        auto size = static_cast<size_t>(is.tellg());
         is.seekg(0);
-        is.read(reinterpret_cast<char*>(lasDataPoints.data()), size);
 
-        for (auto& point : lasDataPoints) {
-            ColorVertex tempVertex{};
-            tempVertex.Pos.x = point.x;
-            tempVertex.Pos.y = point.z;
-            tempVertex.Pos.z = point.y;
-            tempVertex.Color = glm::vec3(1.f, 1.f, 1.f);
-            PointData.push_back(tempVertex);
+        lasBinHeader header{};
+        if (size >= sizeof(header)) {
+            is.read(reinterpret_cast<char*>(&header), sizeof(header));
         }
-    }
+        if (std::memcmp(header.signature, lasBinSignature, sizeof(header.signature)) != 0) {
+            // Version 1 files are a bare array of las ordered positions
+            is.clear();
+            is.seekg(0);
+            std::vector<glm::vec3> lasDataPoints(size / sizeof(glm::vec3));
+            is.read(reinterpret_cast<char*>(lasDataPoints.data()), lasDataPoints.size() * sizeof(glm::vec3));
 
-    void LasLoader::ReadLas(const std::string& path) {
-        lasHeader header;
-        std::ifstream inf(path, std::ios::binary | std::ios::ate);
-        if (inf.is_open()) {
-
-            // Read Header
-            inf.seekg(0);
-            inf.read((char*)&header.fileSignature, sizeof(header.fileSignature));
-            inf.read((char*)&header.sourceID, sizeof(header.sourceID));
-            inf.read((char*)&header.globalEncoding, sizeof(header.globalEncoding));
-            inf.read((char*)&header.GUID1, sizeof(header.GUID1));
-            inf.read((char*)&header.GUID2, sizeof(header.GUID2));
-            inf.read((char*)&header.GUID3, sizeof(header.GUID3));
-            inf.read((char*)&header.GUID4, sizeof(header.GUID4));
-            inf.read((char*)&header.versionMajor, sizeof(header.versionMajor));
-            inf.read((char*)&header.versionMinor, sizeof(header.versionMinor));
-            inf.read((char*)&header.systemIdentifier, sizeof(header.systemIdentifier));
-            inf.read((char*)&header.generatingSoftware, sizeof(header.generatingSoftware));
-            inf.read((char*)&header.creationDay, sizeof(header.creationDay));
-            inf.read((char*)&header.creationYear, sizeof(header.creationYear));
-            inf.read((char*)&header.headerSize, sizeof(header.headerSize));
-            inf.read((char*)&header.offsetToPointData, sizeof(header.offsetToPointData));
-            inf.read((char*)&header.numberVariableLengthRecords, sizeof(header.numberVariableLengthRecords));
-            inf.read((char*)&header.pointDataRecordFormat, sizeof(header.pointDataRecordFormat));
-            inf.read((char*)&header.pointDataRecordLength, sizeof(header.pointDataRecordLength));
-            inf.read((char*)&header.legacyNumberPointsRecords, sizeof(header.legacyNumberPointsRecords));
-            inf.read((char*)&header.legacyNumberPointReturn, sizeof(header.legacyNumberPointReturn));
-            inf.read((char*)&header.xScaleFactor, sizeof(header.xScaleFactor));
-            inf.read((char*)&header.yScaleFactor, sizeof(header.yScaleFactor));
-            inf.read((char*)&header.zScaleFactor, sizeof(header.zScaleFactor));
-            inf.read((char*)&header.xOffset, sizeof(header.xOffset));
-            inf.read((char*)&header.yOffset, sizeof(header.yOffset));
-            inf.read((char*)&header.zOffset, sizeof(header.zOffset));
-            inf.read((char*)&header.maxX, sizeof(header.maxX));
-            inf.read((char*)&header.minX, sizeof(header.minX));
-            inf.read((char*)&header.maxY, sizeof(header.maxY));
-            inf.read((char*)&header.minY, sizeof(header.minY));
-            inf.read((char*)&header.maxZ, sizeof(header.maxZ));
-            inf.read((char*)&header.minZ, sizeof(header.minZ));
-
-            // Save max and min from header (so that we don't need to calculate it later)
-            min.x = header.minX;
-            min.y = header.minZ;
-            min.z = header.minY;
-            max.x = header.maxX;
-            max.y = header.maxZ;
-            max.z = header.maxY;
-
-            // Read pointdata
-            inf.seekg(header.offsetToPointData);
-
-            // Only format 1 and 2 supported
-            ASSERT(header.pointDataRecordFormat == 1 || header.pointDataRecordFormat == 2);
-
-            // Read format 1
-            if (header.pointDataRecordFormat == 1) {
-                for (int i = 0; i < header.legacyNumberPointsRecords; ++i) {
-                    lasPointData1 temp;
-                    inf.seekg(header.offsetToPointData + (header.pointDataRecordLength * i));
-                    inf.read((char*)&temp.xPos, sizeof(temp.xPos));
-                    inf.read((char*)&temp.yPos, sizeof(temp.yPos));
-                    inf.read((char*)&temp.zPos, sizeof(temp.zPos));
-
-                    ColorVertex tempVertex{};
-                    // Final position = (pos * scale factor) + offset
-                    tempVertex.Pos.x = (temp.xPos * header.xScaleFactor) + header.xOffset;
-                    tempVertex.Pos.y = (temp.zPos * header.zScaleFactor) + header.zOffset;
-                    tempVertex.Pos.z = (temp.yPos * header.yScaleFactor) + header.yOffset;
-                    tempVertex.Color = glm::vec3(0.f, 1.f, 0.f);
-                    PointData.push_back(tempVertex);
-                }
-            }
-            // Read format 2
-            else if (header.pointDataRecordFormat == 2) {
-                for (int i = 0; i < header.legacyNumberPointsRecords; ++i) {
-                    lasPointData2 temp;
-                    inf.read((char*)&temp.xPos, sizeof(temp.xPos));
-                    inf.read((char*)&temp.yPos, sizeof(temp.yPos));
-                    inf.read((char*)&temp.zPos, sizeof(temp.zPos));
-                    inf.read((char*)&temp.intensity, sizeof(temp.intensity));
-                    inf.read((char*)&temp.flags, sizeof(temp.flags));
-                    inf.read((char*)&temp.classificaton, sizeof(temp.classificaton));
-                    inf.read((char*)&temp.scanAngle, sizeof(temp.scanAngle));
-                    inf.read((char*)&temp.userData, sizeof(temp.userData));
-                    inf.read((char*)&temp.pointSourceID, sizeof(temp.pointSourceID));
-                    inf.read((char*)&temp.red, sizeof(temp.red));
-                    inf.read((char*)&temp.green, sizeof(temp.green));
-                    inf.read((char*)&temp.blue, sizeof(temp.blue));
-
-                    ColorVertex tempVertex{};
-                    tempVertex.Pos.x = (temp.xPos * header.xScaleFactor) + header.xOffset;
-                    tempVertex.Pos.y = (temp.zPos * header.zScaleFactor) + header.zOffset;
-                    tempVertex.Pos.z = (temp.yPos * header.yScaleFactor) + header.yOffset;
-                    tempVertex.Color = glm::vec3(temp.red * 0.00001, temp.green * 0.00001, temp.blue * 0.00001);
-                    PointData.push_back(tempVertex);
-                }
-            }
-        }
-    }
-}
\ No newline at end of file
+            PointData.Resize(lasDataPoints.size());
+            for (size_t i = 0; i < lasDataPoints.size(); ++i) {
+                PointData.Positions[i] = glm::vec3(lasDataPoints[i].x, lasDataPoints[i].z, lasDataPoints[i].y);
+                PointData.Colors[i] = glm::vec3(1.f, 1.f, 1.f);
+            }
+            if (PointData.Has(LasChannelRecordIndex)) {
+                std::iota(PointData.RecordIndices.begin(), PointData.RecordIndices.end(), 0ull);
+            }
+            return;
+        }
+
+        bool hasColor = (header.channels & LasBinColor) != 0;
+        size_t stride = sizeof(glm::vec3) * (hasColor ? 2 : 1);
+        if ((header.version != 2 && header.version != 3) || !(header.channels & LasBinPosition) || header.headerSize < sizeof(header)
+            || header.headerSize > size || header.pointCount > (size - header.headerSize) / stride) {
+            std::cout << "Unsupported lasbin file: " << path << std::endl;
+            return;
+        }
+
+        min = glm::vec3(header.minX, header.minY, header.minZ);
+        max = glm::vec3(header.maxX, header.maxY, header.maxZ);
+        if (header.axis == LasBinZUp) {
+            std::swap(min.y, min.z);
+            std::swap(max.y, max.z);
+        }
+
+        is.seekg(header.headerSize);
+        PointData.Resize(static_cast<size_t>(header.pointCount));
+
+        if (header.version == 3) {
+            // Version 3 stores whole columns, so each one is read straight into the point cloud
+            is.read(reinterpret_cast<char*>(PointData.Positions.data()), PointData.Size() * sizeof(glm::vec3));
+            if (hasColor) {
+                is.read(reinterpret_cast<char*>(PointData.Colors.data()), PointData.Size() * sizeof(glm::vec3));
+            }
+            else {
+                std::fill(PointData.Colors.begin(), PointData.Colors.end(), glm::vec3(1.f, 1.f, 1.f));
+            }
+            if (header.axis == LasBinZUp) {
+                for (auto& pos : PointData.Positions) {
+                    std::swap(pos.y, pos.z);
+                }
+            }
+        }
+        else {
+            // Version 2 interleaves the points, so read a block at a time and split them into the columns
+            const size_t perPoint = hasColor ? 2 : 1;
+            std::vector<glm::vec3> payload(std::min(PointData.Size(), lasBlockSize) * perPoint);
+            for (size_t first = 0; first < PointData.Size(); first += lasBlockSize) {
+                size_t n = std::min(lasBlockSize, PointData.Size() - first);
+                is.read(reinterpret_cast<char*>(payload.data()), n * stride);
+                for (size_t i = 0; i < n; ++i) {
+                    glm::vec3 pos = payload[i * perPoint];
+                    if (header.axis == LasBinZUp) {
+                        std::swap(pos.y, pos.z);
+                    }
+                    PointData.Positions[first + i] = pos;
+                    PointData.Colors[first + i] = hasColor ? payload[i * 2 + 1] : glm::vec3(1.f, 1.f, 1.f);
+                }
+            }
+        }
+        if (PointData.Has(LasChannelRecordIndex)) {
+            std::iota(PointData.RecordIndices.begin(), PointData.RecordIndices.end(), 0ull);
+        }
+    }
+
+    // Writes the header with the bounds of everything written so far
+    static void WriteLasBinHeader(std::ofstream& os, uint64_t pointCount, const glm::vec3& min, const glm::vec3& max) {
+        lasBinHeader header{};
+        std::memcpy(header.signature, lasBinSignature, sizeof(header.signature));
+        header.version = 3;
+        header.headerSize = sizeof(lasBinHeader);
+        header.pointCount = pointCount;
+        header.axis = LasBinYUp;
+        header.channels = LasBinPosition | LasBinColor;
+        header.minX = min.x;
+        header.minY = min.y;
+        header.minZ = min.z;
+        header.maxX = max.x;
+        header.maxY = max.y;
+        header.maxZ = max.z;
+        os.seekp(0);
+        os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+
+    static void GrowBounds(const ColorVertex* points, size_t count, glm::vec3& min, glm::vec3& max) {
+        for (size_t i = 0; i < count; ++i) {
+            min = glm::min(min, points[i].Pos);
+            max = glm::max(max, points[i].Pos);
+        }
+    }
+
+    // Appends one member of each point to the column being written, gathered a block at a time
+    static void WriteLasBinColumn(std::ofstream& os, const ColorVertex* points, size_t count, glm::vec3 ColorVertex::* member) {
+        std::vector<glm::vec3> column(std::min(count, lasBlockSize));
+        for (size_t first = 0; first < count; first += column.size()) {
+            size_t n = std::min(column.size(), count - first);
+            for (size_t i = 0; i < n; ++i) {
+                column[i] = points[first + i].*member;
+            }
+            os.write(reinterpret_cast<const char*>(column.data()), n * sizeof(glm::vec3));
+        }
+    }
+
+    bool WriteLasBin(const std::string& path, const std::vector<ColorVertex>& points) {
+        std::ofstream os(path, std::ios::binary | std::ios::trunc);
+        if (!os.is_open()) {
+            return false;
+        }
+
+        glm::vec3 min(std::numeric_limits<float>::max());
+        glm::vec3 max(std::numeric_limits<float>::lowest());
+        GrowBounds(points.data(), points.size(), min, max);
+        WriteLasBinHeader(os, points.size(), min, max);
+        WriteLasBinColumn(os, points.data(), points.size(), &ColorVertex::Pos);
+        WriteLasBinColumn(os, points.data(), points.size(), &ColorVertex::Color);
+        return os.good();
+    }
+
+    bool ConvertToLasBin(const std::string& lasPath, const std::string& binPath) {
+        LasPointStream stream(lasPath);
+        std::ofstream os(binPath, std::ios::binary | std::ios::trunc);
+        if (!stream.IsOpen() || !os.is_open()) {
+            return false;
+        }
+
+        // Reserve the header, stream the positions, then go back and fill in count and bounds.
+        // The colors column follows the positions, so the file is streamed a second time for it.
+        glm::vec3 min(std::numeric_limits<float>::max());
+        glm::vec3 max(std::numeric_limits<float>::lowest());
+        WriteLasBinHeader(os, 0, min, max);
+        std::vector<ColorVertex> batch;
+        uint64_t count = 0;
+        while (stream.Next(batch)) {
+            GrowBounds(batch.data(), batch.size(), min, max);
+            WriteLasBinColumn(os, batch.data(), batch.size(), &ColorVertex::Pos);
+            count += batch.size();
+        }
+
+        LasPointStream colors(lasPath);
+        uint64_t written = 0;
+        while (written < count && colors.Next(batch)) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(batch.size(), count - written));
+            WriteLasBinColumn(os, batch.data(), n, &ColorVertex::Color);
+            written += n;
+        }
+        WriteLasBinHeader(os, count, min, max);
+        return os.good() && written == count;
+    }
+
+    std::string LasLoader::TerrainCacheKey(const std::vector<std::string>& paths) const {
+        std::ostringstream key;
+        key << "v" << terrainCacheVersion;
+
+        // Each source is identified by where it is, how big it is and when it was last written
+        for (const auto& path : paths) {
+            std::error_code error;
+            std::filesystem::path source = std::filesystem::canonical(path, error);
+            if (error) {
+                return {};
+            }
+            auto size = std::filesystem::file_size(source, error);
+            if (error) {
+                return {};
+            }
+            auto written = std::filesystem::last_write_time(source, error);
+            if (error) {
+                return {};
+            }
+            key << "|" << source.string()
+                << "|" << size
+                << "|" << written.time_since_epoch().count();
+        }
+        if (settings.decimation != LasDecimateNone) {
+            key << "|decimation " << settings.decimation << " " << settings.decimationStride << " " << std::hexfloat
+                << settings.decimationFraction << " " << settings.decimationSeed << " " << settings.voxelSize << std::defaultfloat;
+        }
+        if (settings.filter.IsActive()) {
+            key << "|filter";
+            for (uint8_t classification : settings.filter.classifications) {
+                key << " " << int(classification);
+            }
+            key << " " << settings.filter.onlyFirstReturns << settings.filter.onlyLastReturns
+                << settings.filter.dropWithheld << settings.filter.dropSynthetic;
+        }
+        if (CellSize() != 1.f) {
+            key << "|cell " << std::hexfloat << CellSize() << std::defaultfloat;
+        }
+        if (hasRegion) {
+            key << "|region " << std::hexfloat << regionMin.x << " " << regionMin.y << " " << regionMax.x << " " << regionMax.y;
+        }
+        return key.str();
+    }
+
+    template<typename T>
+    static bool ReadArray(const char*& src, const char* end, uint64_t count, std::vector<T>& out) {
+        if (count > static_cast<uint64_t>(end - src) / sizeof(T)) {
+            return false;
+        }
+        out.resize(static_cast<size_t>(count));
+        std::memcpy(out.data(), src, out.size() * sizeof(T));
+        src += out.size() * sizeof(T);
+        return true;
+    }
+
+    bool LasLoader::LoadTerrainCache(const std::string& cachePath, const std::string& key) {
+        MappedFile file(cachePath);
+        terrainCacheHeader header;
+        if (!file.IsOpen() || file.Size() < sizeof(header)) {
+            return false;
+        }
+        std::memcpy(&header, file.Data(), sizeof(header));
+        const char* src = file.Data() + sizeof(header);
+        const char* end = file.Data() + file.Size();
+
+        // The full key is stored too, so a hash collision is a miss instead of the wrong terrain
+        if (std::memcmp(header.signature, terrainCacheSignature, sizeof(header.signature)) != 0
+            || header.version != terrainCacheVersion || header.keyLength != key.size()
+            || static_cast<size_t>(end - src) < key.size() || key.compare(0, key.size(), src, key.size()) != 0) {
+            return false;
+        }
+        src += key.size();
+
+        if (!ReadArray(src, end, header.vertexCount, VertexData)
+            || !ReadArray(src, end, header.colorNormalVertexCount, ColorNormalVertexData)
+            || !ReadArray(src, end, header.indexCount, IndexData)) {
+            VertexData.clear();
+            ColorNormalVertexData.clear();
+            IndexData.clear();
+            return false;
+        }
+
+        xSquares = header.xSquares;
+        zSquares = header.zSquares;
+        min = header.min;
+        max = header.max;
+        middle = header.middle;
+        offset = header.offset;
+        return true;
+    }
+
+    void LasLoader::SaveTerrainCache(const std::string& cachePath, const std::string& key) const {
+        std::error_code error;
+        std::filesystem::create_directories(settings.cacheDirectory, error);
+
+        terrainCacheHeader header{};
+        std::memcpy(header.signature, terrainCacheSignature, sizeof(header.signature));
+        header.version = terrainCacheVersion;
+        header.keyLength = static_cast<uint32_t>(key.size());
+        header.vertexCount = VertexData.size();
+        header.colorNormalVertexCount = ColorNormalVertexData.size();
+        header.indexCount = IndexData.size();
+        header.xSquares = xSquares;
+        header.zSquares = zSquares;
+        header.min = min;
+        header.max = max;
+        header.middle = middle;
+        header.offset = offset;
+
+        // Write next to the target and rename, so a reader never maps a half written cache
+        std::string tempPath = cachePath + ".tmp";
+        {
+            std::ofstream os(tempPath, std::ios::binary | std::ios::trunc);
+            if (!os.is_open()) {
+                return;
+            }
+            os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            os.write(key.data(), key.size());
+            os.write(reinterpret_cast<const char*>(VertexData.data()), VertexData.size() * sizeof(MeshVertex));
+            os.write(reinterpret_cast<const char*>(ColorNormalVertexData.data()), ColorNormalVertexData.size() * sizeof(ColorNormalVertex));
+            os.write(reinterpret_cast<const char*>(IndexData.data()), IndexData.size() * sizeof(uint32_t));
+            if (!os.good()) {
+                os.close();
+                std::filesystem::remove(tempPath, error);
+                return;
+            }
+        }
+        std::filesystem::rename(tempPath, cachePath, error);
+        if (error) {
+            std::filesystem::remove(tempPath, error);
+        }
+    }
+
+    void LasLoader::ReadLas(const std::string& path) {
+        if (hasRegion && ReadLasRegion(path)) {
+            return;
+        }
+        if (settings.asyncRead) {
+            ReadLasAsync(path);
+            return;
+        }
+        LasFile file(path);
+        if (!file.IsOpen()) {
+            // Fall back to block reads if the file could not be mapped (e.g. too large for a 32 bit build)
+            ReadLasBuffered(path);
+            return;
+        }
+        const lasHeader& header = file.Header();
+        SetBoundsFromHeader(header);
+
+        if (!IsLasFormatSupported(header)) {
+            std::cout << "Unsupported point data record format " << int(header.pointDataRecordFormat) << ": " << path << std::endl;
+            return;
+        }
+
+        // Every record sits at a fixed offset, so each worker decodes its own slice of PointData
+        LasPointView points = file.Points();
+        PointDecimator decimator(settings);
+        if (settings.quantizedStorage && !decimator.IsActive() && settings.channels == 0) {
+            ReadLasQuantized(header, points.empty() ? nullptr : points[0].Data(), points.size());
+            return;
+        }
+        PointFilterTable filter(settings.filter);
+        if (decimator.IsActive() || filter.active) {
+            std::unordered_set<uint64_t> voxels;
+            DecodeSelected(decimator, 0, points.size(), settings.threadCount, [&](size_t first, size_t n, PointCloud& out, uint32_t* indices) {
+                return DecodeBlock(header, points[first].Data(), n, filter.Get(), { nullptr, &out, 0, first }, indices);
+            }, PointData, voxels);
+            pointsDecimated = true;
+            return;
+        }
+        PointData.Resize(points.size());
+        ParallelFor(points.size(), settings.threadCount, minItemsPerThread, [&](size_t begin, size_t end) {
+            if (begin != end) {
+                DecodeBlock(header, points[begin].Data(), end - begin, nullptr, { nullptr, &PointData, begin, begin }, nullptr);
+            }
+        });
+    }
+
+    void LasLoader::ReadLasBuffered(const std::string& path) {
+        std::ifstream is(path, std::ios::binary | std::ios::ate);
+        const uint64_t fileSize = is.is_open() ? static_cast<uint64_t>(is.tellg()) : 0;
+        is.seekg(0);
+        char headerBytes[lasHeaderMaxSize];
+        is.read(headerBytes, sizeof(headerBytes));
+        lasHeader header;
+        if (!is.is_open() || !ReadLasHeader(headerBytes, static_cast<size_t>(is.gcount()), header)) {
+            std::cout << "Cant open file: " << path << std::endl;
+            return;
+        }
+        SetBoundsFromHeader(header);
+
+        if (!IsLasFormatSupported(header)) {
+            std::cout << "Unsupported point data record format " << int(header.pointDataRecordFormat) << ": " << path << std::endl;
+            return;
+        }
+
+        // Records are read a block at a time and decoded straight into the columns
+        is.clear();
+        is.seekg(header.offsetToPointData);
+        PointFilterTable filter(settings.filter);
+        // The columns are sized up front, so never trust the header count further than the file reaches
+        const size_t stride = header.pointDataRecordLength;
+        const uint64_t available = fileSize > header.offsetToPointData ? (fileSize - header.offsetToPointData) / stride : 0;
+        std::vector<char> records(lasBlockSize * stride);
+        PointData.Resize(static_cast<size_t>(std::min<uint64_t>(header.numberOfPointRecords, available)));
+        size_t read = 0;
+        size_t done = 0;
+        while (read < PointData.Size() && is) {
+            is.read(records.data(), std::min(lasBlockSize, PointData.Size() - read) * stride);
+            size_t got = static_cast<size_t>(is.gcount()) / stride;
+            done += DecodeBlock(header, records.data(), got, filter.Get(), { nullptr, &PointData, done, read }, nullptr);
+            read += got;
+        }
+        PointData.Resize(done);
+    }
+
+    // Bytes per async read, rounded down to whole records so a block never splits one. Blocks grow up to
+    // the maximum so that each one still gives every thread minItemsPerThread records to decode.
+    constexpr size_t asyncReadBlockBytes = 4 << 20;
+    constexpr size_t asyncReadMaxBlockBytes = 64 << 20;
+
+    void LasLoader::ReadLasAsync(const std::string& path) {
+        std::ifstream is(path, std::ios::binary | std::ios::ate);
+        const uint64_t fileSize = is.is_open() ? static_cast<uint64_t>(is.tellg()) : 0;
+        is.seekg(0);
+        char headerBytes[lasHeaderMaxSize];
+        is.read(headerBytes, sizeof(headerBytes));
+        lasHeader header;
+        if (!is.is_open() || !ReadLasHeader(headerBytes, static_cast<size_t>(is.gcount()), header)) {
+            std::cout << "Cant open file: " << path << std::endl;
+            return;
+        }
+        is.close();
+        SetBoundsFromHeader(header);
+
+        if (!IsLasFormatSupported(header)) {
+            std::cout << "Unsupported point data record format " << int(header.pointDataRecordFormat) << ": " << path << std::endl;
+            return;
+        }
+
+        // Never trust the header count further than the file actually reaches
+        const size_t stride = header.pointDataRecordLength;
+        const uint64_t available = fileSize > header.offsetToPointData ? (fileSize - header.offsetToPointData) / stride : 0;
+        const size_t total = static_cast<size_t>(std::min<uint64_t>(header.numberOfPointRecords, available));
+
+        const size_t threads = ResolveThreadCount(settings.threadCount);
+        const size_t blockRecords = std::clamp(threads * minItemsPerThread, asyncReadBlockBytes / stride, asyncReadMaxBlockBytes / stride);
+        const size_t blockBytes = std::max<size_t>(blockRecords, 1) * stride;
+        AsyncBlockReader reader(path, header.offsetToPointData, static_cast<uint64_t>(total) * stride, blockBytes);
+        if (!reader.IsOpen()) {
+            std::cout << "Cant open file: " << path << std::endl;
+            return;
+        }
+
+        // Each block is decoded while the reads behind it are still in flight
+        PointDecimator decimator(settings);
+        PointFilterTable filter(settings.filter);
+        const bool selective = decimator.IsActive() || filter.active;
+        std::unordered_set<uint64_t> voxels;
+        if (!selective) {
+            PointData.Resize(total);
+        }
+        size_t done = 0;
+        const char* block = nullptr;
+        size_t bytes;
+        while ((bytes = reader.Next(block)) != 0 && bytes != AsyncBlockReader::readFailed) {
+            size_t count = std::min(bytes / stride, total - done);
+            if (selective) {
+                DecodeSelected(decimator, done, count, settings.threadCount, [&](size_t first, size_t n, PointCloud& out, uint32_t* indices) {
+                    return DecodeBlock(header, block + first * stride, n, filter.Get(), { nullptr, &out, 0, done + first }, indices);
+                }, PointData, voxels);
+            }
+            else {
+                ParallelFor(count, settings.threadCount, minItemsPerThread, [&](size_t begin, size_t end) {
+                    if (begin != end) {
+                        DecodeBlock(header, block + begin * stride, end - begin, nullptr, { nullptr, &PointData, done + begin, done + begin }, nullptr);
+                    }
+                });
+            }
+            done += count;
+        }
+        if (bytes == AsyncBlockReader::readFailed) {
+            std::cout << "Read error: " << path << std::endl;
+            PointData.Clear();
+            return;
+        }
+        if (selective) {
+            pointsDecimated = true;
+        }
+        else {
+            PointData.Resize(done);
+        }
+    }
+
+    bool LasLoader::ReadLasRegion(const std::string& path) {
+        LasFile file(path);
+        if (!file.IsOpen() || !IsLasFormatSupported(file.Header())) {
+            return false;
+        }
+        const lasHeader& header = file.Header();
+        SetBoundsFromHeader(header);
+
+        // Build the sidecar on first use, a read-only location just means building it every time
+        LasPointView points = file.Points();
+        std::string indexPath = LasIndexPath(path);
+        LasSpatialIndex index;
+        if (!index.Load(indexPath, header, points.size())) {
+            index.Build(header, points.empty() ? nullptr : points[0].Data(), points.size());
+            index.Save(indexPath);
+        }
+
+        std::vector<LasRecordRange> ranges = index.Query(regionMin.x, regionMin.y, regionMax.x, regionMax.y);
+        std::vector<size_t> firstPoint(ranges.size() + 1, 0);
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            firstPoint[i + 1] = firstPoint[i] + static_cast<size_t>(ranges[i].last - ranges[i].first);
+        }
+
+        // Split the ranges between workers so each gets roughly minItemsPerThread points
+        PointFilterTable filter(settings.filter);
+        std::vector<size_t> kept(ranges.size(), 0);
+        PointData.Resize(firstPoint.back());
+        size_t rangesPerThread = std::max<size_t>(1, ranges.size() * minItemsPerThread / std::max<size_t>(PointData.Size(), 1));
+        ParallelFor(ranges.size(), settings.threadCount, rangesPerThread, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                kept[i] = DecodeBlock(header, points[static_cast<size_t>(ranges[i].first)].Data(),
+                    static_cast<size_t>(ranges[i].last - ranges[i].first), filter.Get(), { nullptr, &PointData, firstPoint[i], ranges[i].first }, nullptr);
+            }
+        });
+        CompactSlices(PointData, firstPoint, kept);
+        return true;
+    }
+
+    void LasLoader::ClipToRegion() {
+        // Index ranges are conservative and other formats are read whole, so drop everything outside the box
+        PointData.KeepIf([&](size_t i) {
+            const glm::vec3& pos = PointData.Positions[i];
+            return !(pos.x < regionMin.x || pos.x > regionMax.x
+                || pos.z < regionMin.y || pos.z > regionMax.y);
+        });
+
+        // Known bounds shrink to the box, unknown ones are found from the remaining points later
+        if (max != glm::vec3(0.f)) {
+            min.x = std::max(min.x, static_cast<float>(regionMin.x));
+            min.z = std::max(min.z, static_cast<float>(regionMin.y));
+            max.x = std::min(max.x, static_cast<float>(regionMax.x));
+            max.z = std::min(max.z, static_cast<float>(regionMax.y));
+            max = glm::max(max, min);
+        }
+    }
+
+    // Offset of the red channel in a record, 0 for formats without color
+    static size_t LasColorOffset(uint8_t format) {
+        switch (format) {
+        case 2: return LasPointFormat<2>::colorOffset;
+        case 3: return LasPointFormat<3>::colorOffset;
+        case 5: return LasPointFormat<5>::colorOffset;
+        case 7: return LasPointFormat<7>::colorOffset;
+        case 8: return LasPointFormat<8>::colorOffset;
+        case 10: return LasPointFormat<10>::colorOffset;
+        default: return 0;
+        }
+    }
+
+    void LasLoader::ReadLasQuantized(const lasHeader& header, const char* records, size_t count) {
+        const size_t stride = header.pointDataRecordLength;
+        const size_t colorOffset = LasColorOffset(header.pointDataRecordFormat);
+        const PointFilterTable filter(settings.filter);
+        auto accepts = [&](const char* record) { return !filter.active || filter.Accepts(header.pointDataRecordFormat, record); };
+
+        // The raw extent decides how narrow each column can be, so it is found from the records rather than the header.
+        // The same pass counts what passes the filter, which fixes where each part writes its points.
+        const size_t parts = std::max<size_t>(1, std::min<size_t>(ResolveThreadCount(settings.threadCount), count / minItemsPerThread));
+        std::vector<glm::ivec3> partMin(parts, glm::ivec3(std::numeric_limits<int32_t>::max()));
+        std::vector<glm::ivec3> partMax(parts, glm::ivec3(std::numeric_limits<int32_t>::min()));
+        std::vector<size_t> partFirst(parts + 1, 0);
+        ParallelFor(parts, settings.threadCount, 1, [&](size_t beginPart, size_t endPart) {
+            for (size_t part = beginPart; part < endPart; ++part) {
+                for (size_t i = count * part / parts; i < count * (part + 1) / parts; ++i) {
+                    LasRecord record(records + i * stride);
+                    if (!accepts(record.Data())) {
+                        continue;
+                    }
+                    glm::ivec3 raw(record.X(), record.Y(), record.Z());
+                    partMin[part] = glm::min(partMin[part], raw);
+                    partMax[part] = glm::max(partMax[part], raw);
+                    partFirst[part + 1]++;
+                }
+            }
+        });
+        glm::ivec3 rawMin = partMin[0];
+        glm::ivec3 rawMax = partMax[0];
+        for (size_t part = 1; part < parts; ++part) {
+            rawMin = glm::min(rawMin, partMin[part]);
+            rawMax = glm::max(rawMax, partMax[part]);
+        }
+        for (size_t part = 0; part < parts; ++part) {
+            partFirst[part + 1] += partFirst[part];
+        }
+
+        QuantizedPoints.Reset(glm::dvec3(header.xScaleFactor, header.yScaleFactor, header.zScaleFactor),
+            glm::dvec3(header.xOffset, header.yOffset, header.zOffset), rawMin, rawMax, partFirst[parts], colorOffset != 0);
+        ParallelFor(parts, settings.threadCount, 1, [&](size_t beginPart, size_t endPart) {
+            for (size_t part = beginPart; part < endPart; ++part) {
+                size_t index = partFirst[part];
+                for (size_t i = count * part / parts; i < count * (part + 1) / parts; ++i) {
+                    LasRecord record(records + i * stride);
+                    if (!accepts(record.Data())) {
+                        continue;
+                    }
+                    QuantizedPoints.SetPosition(index, record.X(), record.Y(), record.Z());
+                    if (colorOffset != 0) {
+                        QuantizedPoints.SetColor(index, record.Get<uint16_t>(colorOffset), record.Get<uint16_t>(colorOffset + 2), record.Get<uint16_t>(colorOffset + 4));
+                    }
+                    ++index;
+                }
+            }
+        });
+    }
+
+    void LasLoader::DecimatePoints() {
+        // Readers that could not thin points while decoding get the same selection applied afterwards
+        PointDecimator decimator(settings);
+        if (!decimator.IsActive() || pointsDecimated) {
+            return;
+        }
+        PointCloud kept(PointData.Channels());
+        std::unordered_set<uint64_t> voxels;
+        DecodeSelected(decimator, 0, PointData.Size(), settings.threadCount, [&](size_t first, size_t n, PointCloud& out, uint32_t* indices) {
+            out.Clear();
+            out.Append(PointData, first, n);
+            std::iota(indices, indices + n, 0u);
+            return n;
+        }, kept, voxels);
+        PointData = std::move(kept);
+        pointsDecimated = true;
+    }
+
+    void LasLoader::SetBoundsFromHeader(const lasHeader& header) {
+        // Save max and min from header (so that we don't need to calculate it later)
+        min.x = header.minX;
+        min.y = header.minZ;
+        min.z = header.minY;
+        max.x = header.maxX;
+        max.y = header.maxZ;
+        max.z = header.maxY;
+    }
+
+    size_t LasRecordLength(uint8_t format) {
+        switch (format) {
+        case 0: return LasPointFormat<0>::recordLength;
+        case 1: return LasPointFormat<1>::recordLength;
+        case 2: return LasPointFormat<2>::recordLength;
+        case 3: return LasPointFormat<3>::recordLength;
+        case 4: return LasPointFormat<4>::recordLength;
+        case 5: return LasPointFormat<5>::recordLength;
+        case 6: return LasPointFormat<6>::recordLength;
+        case 7: return LasPointFormat<7>::recordLength;
+        case 8: return LasPointFormat<8>::recordLength;
+        case 9: return LasPointFormat<9>::recordLength;
+        case 10: return LasPointFormat<10>::recordLength;
+        default: return 0;
+        }
+    }
+
+    bool IsLasFormatSupported(const lasHeader& header) {
+        size_t length = LasRecordLength(header.pointDataRecordFormat);
+        return length != 0 && header.pointDataRecordLength >= length;
+    }
+
+    // Copies a decoded point and the extra channels the cloud asked for into its columns
+    template<uint8_t Format>
+    static void StorePoint(PointCloud& cloud, size_t index, const ColorVertex& vertex, const LasRecord& record, uint64_t recordIndex) {
+        using Layout = LasPointFormat<Format>;
+        cloud.Positions[index] = vertex.Pos;
+        cloud.Colors[index] = vertex.Color;
+        if (cloud.Has(LasChannelIntensity)) {
+            cloud.Intensities[index] = record.Get<uint16_t>(Layout::intensityOffset);
+        }
+        if (cloud.Has(LasChannelClassification)) {
+            uint8_t classification = record.Get<uint8_t>(Layout::classificationOffset);
+            cloud.Classifications[index] = Layout::extended ? classification : classification & 0x1F;
+        }
+        if (cloud.Has(LasChannelGpsTime)) {
+            cloud.GpsTimes[index] = Layout::hasGpsTime ? record.Get<double>(Layout::gpsTimeOffset) : 0.0;
+        }
+        if (cloud.Has(LasChannelPointSourceID)) {
+            cloud.PointSourceIDs[index] = record.Get<uint16_t>(Layout::pointSourceIDOffset);
+        }
+        // Formats 6-10 store the angle in 0.006 degree steps, the older ones in whole degrees
+        if (cloud.Has(LasChannelScanAngle)) {
+            cloud.ScanAngles[index] = Layout::extended ? record.Get<int16_t>(Layout::scanAngleOffset) * 0.006f
+                : static_cast<float>(record.Get<int8_t>(Layout::scanAngleOffset));
+        }
+        if (cloud.Has(LasChannelRecordIndex)) {
+            cloud.RecordIndices[index] = recordIndex;
+        }
+    }
+
+    // One instantiation per point format and filter use, so the record layout is fixed at compile time.
+    // Kept points are packed at the start of out, indices (if given) gets the record offset of each one.
+    template<uint8_t Format, bool Filtered>
+    static size_t DecodeRecords(const lasHeader& header, const char* records, size_t count, const PointFilterTable* filter, const PointSink& out, uint32_t* indices) {
+        using Layout = LasPointFormat<Format>;
+        const size_t stride = header.pointDataRecordLength;
+
+        // Gather coordinates a batch at a time so DequantizePositions can convert them in one pass
+        constexpr size_t batchSize = 256;
+        int32_t x[batchSize];
+        int32_t y[batchSize];
+        int32_t z[batchSize];
+        uint32_t source[batchSize];
+        ColorVertex local[batchSize];
+
+        size_t written = 0;
+        for (size_t first = 0; first < count; first += batchSize) {
+            size_t n = std::min(batchSize, count - first);
+            const char* batch = records + first * stride;
+            size_t kept = 0;
+            for (size_t i = 0; i < n; ++i) {
+                if constexpr (Filtered) {
+                    if (!filter->Accepts<Format>(batch + i * stride)) {
+                        continue;
+                    }
+                }
+                LasRecord record(batch + i * stride);
+                x[kept] = record.X();
+                y[kept] = record.Y();
+                z[kept] = record.Z();
+                source[kept++] = static_cast<uint32_t>(i);
+            }
+            // Clouds get the batch staged in local and then copied into their columns
+            ColorVertex* vertices = out.vertices != nullptr ? out.vertices + written : local;
+            DequantizePositions(header, x, y, z, kept, vertices);
+
+            // Formats without color channels get the default green
+            for (size_t i = 0; i < kept; ++i) {
+                LasRecord record(batch + source[i] * stride);
+                if constexpr (Layout::hasColor) {
+                    vertices[i].Color = glm::vec3(record.Get<uint16_t>(Layout::colorOffset) * 0.00001,
+                        record.Get<uint16_t>(Layout::colorOffset + 2) * 0.00001,
+                        record.Get<uint16_t>(Layout::colorOffset + 4) * 0.00001);
+                }
+                else {
+                    vertices[i].Color = glm::vec3(0.f, 1.f, 0.f);
+                }
+                if (out.cloud != nullptr) {
+                    StorePoint<Format>(*out.cloud, out.first + written + i, vertices[i], record, out.firstRecord + first + source[i]);
+                }
+                if (indices != nullptr) {
+                    indices[written + i] = static_cast<uint32_t>(first) + source[i];
+                }
+            }
+            written += kept;
+        }
+        return written;
+    }
+
+    template<uint8_t Format>
+    static size_t DecodeFormat(const lasHeader& header, const char* records, size_t count, const PointFilterTable* filter, const PointSink& out, uint32_t* indices) {
+        return filter != nullptr ? DecodeRecords<Format, true>(header, records, count, filter, out, indices)
+            : DecodeRecords<Format, false>(header, records, count, filter, out, indices);
+    }
+
+    static size_t DecodeBlock(const lasHeader& header, const char* records, size_t count, const PointFilterTable* filter, const PointSink& out, uint32_t* indices) {
+        switch (header.pointDataRecordFormat) {
+        case 0: return DecodeFormat<0>(header, records, count, filter, out, indices);
+        case 1: return DecodeFormat<1>(header, records, count, filter, out, indices);
+        case 2: return DecodeFormat<2>(header, records, count, filter, out, indices);
+        case 3: return DecodeFormat<3>(header, records, count, filter, out, indices);
+        case 4: return DecodeFormat<4>(header, records, count, filter, out, indices);
+        case 5: return DecodeFormat<5>(header, records, count, filter, out, indices);
+        case 6: return DecodeFormat<6>(header, records, count, filter, out, indices);
+        case 7: return DecodeFormat<7>(header, records, count, filter, out, indices);
+        case 8: return DecodeFormat<8>(header, records, count, filter, out, indices);
+        case 9: return DecodeFormat<9>(header, records, count, filter, out, indices);
+        case 10: return DecodeFormat<10>(header, records, count, filter, out, indices);
+        default: ASSERT(false); return 0;
+        }
+    }
+
+    void DecodeLasBlock(const lasHeader& header, const char* records, size_t count, ColorVertex* out) {
+        DecodeBlock(header, records, count, nullptr, { out }, nullptr);
+    }
+
+    size_t DecodeLasBlock(const lasHeader& header, const char* records, size_t count, const LasPointFilter& filter, ColorVertex* out) {
+        PointFilterTable table(filter);
+        return DecodeBlock(header, records, count, table.Get(), { out }, nullptr);
+    }
+
+    // Final position = (pos * scale factor) + offset, computed in double and then rounded to float
+    static void DequantizeScalar(const glm::dvec3& scale, const glm::dvec3& shift,
+        const int32_t* x, const int32_t* y, const int32_t* z, size_t count, ColorVertex* out) {
+        for (size_t i = 0; i < count; ++i) {
+            out[i].Pos.x = static_cast<float>((x[i] * scale.x) + shift.x);
+            out[i].Pos.y = static_cast<float>((z[i] * scale.z) + shift.z);
+            out[i].Pos.z = static_cast<float>((y[i] * scale.y) + shift.y);
+        }
+    }
+
+#ifdef LAS_SIMD_X86
+    // Transposes four (x, y, z) lanes into four positions and stores 12 bytes each, leaving Color alone
+    static inline void StorePositions(__m128 px, __m128 py, __m128 pz, ColorVertex* out) {
+        __m128 pw = _mm_setzero_ps();
+        _MM_TRANSPOSE4_PS(px, py, pz, pw);
+        __m128 rows[4] = { px, py, pz, pw };
+        for (int i = 0; i < 4; ++i) {
+            float* dst = &out[i].Pos.x;
+            _mm_storel_pi(reinterpret_cast<__m64*>(dst), rows[i]);
+            _mm_store_ss(dst + 2, _mm_movehl_ps(rows[i], rows[i]));
+        }
+    }
+
+    static inline __m128 DequantizeLanesSse2(const int32_t* src, __m128d scale, __m128d shift) {
+        __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        __m128d lo = _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(raw), scale), shift);
+        __m128d hi = _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(raw, raw)), scale), shift);
+        return _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi));
+    }
+
+    static void DequantizeSse2(const glm::dvec3& scale, const glm::dvec3& shift,
+        const int32_t* x, const int32_t* y, const int32_t* z, size_t count, ColorVertex* out) {
+        __m128d sx = _mm_set1_pd(scale.x), sy = _mm_set1_pd(scale.y), sz = _mm_set1_pd(scale.z);
+        __m128d ox = _mm_set1_pd(shift.x), oy = _mm_set1_pd(shift.y), oz = _mm_set1_pd(shift.z);
+
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m128 px = DequantizeLanesSse2(x + i, sx, ox);
+            __m128 py = DequantizeLanesSse2(z + i, sz, oz);
+            __m128 pz = DequantizeLanesSse2(y + i, sy, oy);
+            StorePositions(px, py, pz, out + i);
+        }
+        DequantizeScalar(scale, shift, x + i, y + i, z + i, count - i, out + i);
+    }
+
+    LAS_TARGET_AVX static inline __m128 DequantizeLanesAvx(const int32_t* src, __m256d scale, __m256d shift) {
+        __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        return _mm256_cvtpd_ps(_mm256_add_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(raw), scale), shift));
+    }
+
+    LAS_TARGET_AVX static void DequantizeAvx(const glm::dvec3& scale, const glm::dvec3& shift,
+        const int32_t* x, const int32_t* y, const int32_t* z, size_t count, ColorVertex* out) {
+        __m256d sx = _mm256_set1_pd(scale.x), sy = _mm256_set1_pd(scale.y), sz = _mm256_set1_pd(scale.z);
+        __m256d ox = _mm256_set1_pd(shift.x), oy = _mm256_set1_pd(shift.y), oz = _mm256_set1_pd(shift.z);
+
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m128 px = DequantizeLanesAvx(x + i, sx, ox);
+            __m128 py = DequantizeLanesAvx(z + i, sz, oz);
+            __m128 pz = DequantizeLanesAvx(y + i, sy, oy);
+            StorePositions(px, py, pz, out + i);
+        }
+        DequantizeScalar(scale, shift, x + i, y + i, z + i, count - i, out + i);
+    }
+
+    static bool CpuHasAvx() {
+#if defined(_MSC_VER) && !defined(__clang__)
+        // AVX needs both the cpu flag and the OS saving the ymm registers
+        int info[4];
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        return osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+#else
+        return __builtin_cpu_supports("avx");
+#endif
+    }
+#endif // LAS_SIMD_X86
+
+    using DequantizeKernel = void (*)(const glm::dvec3&, const glm::dvec3&,
+        const int32_t*, const int32_t*, const int32_t*, size_t, ColorVertex*);
+
+    static DequantizeKernel SelectDequantizeKernel() {
+#ifdef LAS_SIMD_X86
+        if (CpuHasAvx()) {
+            return DequantizeAvx;
+        }
+        return DequantizeSse2;
+#else
+        return DequantizeScalar;
+#endif
+    }
+
+    static void DequantizeWith(const glm::dvec3& scale, const glm::dvec3& shift, const int32_t* x, const int32_t* y, const int32_t* z, size_t count, ColorVertex* out) {
+        static const DequantizeKernel kernel = SelectDequantizeKernel();
+        kernel(scale, shift, x, y, z, count, out);
+    }
+
+    void DequantizePositions(const lasHeader& header, const int32_t* x, const int32_t* y, const int32_t* z, size_t count, ColorVertex* out) {
+        glm::dvec3 scale(header.xScaleFactor, header.yScaleFactor, header.zScaleFactor);
+        glm::dvec3 shift(header.xOffset, header.yOffset, header.zOffset);
+        DequantizeWith(scale, shift, x, y, z, count, out);
+    }
+
+    void PointCloud::Resize(size_t count) {
+        ForEachColumn([&](auto& column) { column.resize(count); });
+    }
+
+    void PointCloud::Reserve(size_t count) {
+        ForEachColumn([&](auto& column) { column.reserve(count); });
+    }
+
+    void PointCloud::Clear() {
+        ForEachColumn([](auto& column) { column.clear(); });
+    }
+
+    void PointCloud::SetChannels(uint32_t channels) {
+        this->channels = channels;
+        auto update = [&](LasChannel channel, auto& column) {
+            if (Has(channel)) {
+                column.resize(Size());
+            }
+            else {
+                std::exchange(column, {});
+            }
+        };
+        update(LasChannelIntensity, Intensities);
+        update(LasChannelClassification, Classifications);
+        update(LasChannelGpsTime, GpsTimes);
+        update(LasChannelPointSourceID, PointSourceIDs);
+        update(LasChannelScanAngle, ScanAngles);
+        update(LasChannelRecordIndex, RecordIndices);
+    }
+
+    // A source without the column (e.g. txt points asked for intensity) contributes zeros
+    template<typename T>
+    static void AppendColumn(std::vector<T>& column, const std::vector<T>& source, size_t first, size_t count) {
+        if (source.empty()) {
+            column.resize(column.size() + count);
+            return;
+        }
+        column.insert(column.end(), source.begin() + first, source.begin() + first + count);
+    }
+
+    template<typename T>
+    static void AppendColumn(std::vector<T>& column, const std::vector<T>& source, const uint32_t* indices, size_t count) {
+        size_t start = column.size();
+        column.resize(start + count);
+        if (!source.empty()) {
+            for (size_t i = 0; i < count; ++i) {
+                column[start + i] = source[indices[i]];
+            }
+        }
+    }
+
+    void PointCloud::Append(const PointCloud& other, size_t first, size_t count) {
+        AppendColumn(Positions, other.Positions, first, count);
+        AppendColumn(Colors, other.Colors, first, count);
+        if (Has(LasChannelIntensity)) AppendColumn(Intensities, other.Intensities, first, count);
+        if (Has(LasChannelClassification)) AppendColumn(Classifications, other.Classifications, first, count);
+        if (Has(LasChannelGpsTime)) AppendColumn(GpsTimes, other.GpsTimes, first, count);
+        if (Has(LasChannelPointSourceID)) AppendColumn(PointSourceIDs, other.PointSourceIDs, first, count);
+        if (Has(LasChannelScanAngle)) AppendColumn(ScanAngles, other.ScanAngles, first, count);
+        if (Has(LasChannelRecordIndex)) AppendColumn(RecordIndices, other.RecordIndices, first, count);
+    }
+
+    void PointCloud::AppendSelected(const PointCloud& other, const uint32_t* indices, size_t count) {
+        AppendColumn(Positions, other.Positions, indices, count);
+        AppendColumn(Colors, other.Colors, indices, count);
+        if (Has(LasChannelIntensity)) AppendColumn(Intensities, other.Intensities, indices, count);
+        if (Has(LasChannelClassification)) AppendColumn(Classifications, other.Classifications, indices, count);
+        if (Has(LasChannelGpsTime)) AppendColumn(GpsTimes, other.GpsTimes, indices, count);
+        if (Has(LasChannelPointSourceID)) AppendColumn(PointSourceIDs, other.PointSourceIDs, indices, count);
+        if (Has(LasChannelScanAngle)) AppendColumn(ScanAngles, other.ScanAngles, indices, count);
+        if (Has(LasChannelRecordIndex)) AppendColumn(RecordIndices, other.RecordIndices, indices, count);
+    }
+
+    void PointCloud::Append(const ColorVertex* vertices, size_t count) {
+        size_t start = Size();
+        Resize(start + count);
+        for (size_t i = 0; i < count; ++i) {
+            Positions[start + i] = vertices[i].Pos;
+            Colors[start + i] = vertices[i].Color;
+        }
+    }
+
+    void PointCloud::MoveDown(size_t from, size_t to, size_t count) {
+        ForEachColumn([&](auto& column) { std::copy_n(column.begin() + from, count, column.begin() + to); });
+    }
+
+    std::vector<ColorVertex> PointCloud::ToVertices() const {
+        std::vector<ColorVertex> vertices(Size());
+        for (size_t i = 0; i < vertices.size(); ++i) {
+            vertices[i] = { Positions[i], Colors[i] };
+        }
+        return vertices;
+    }
+
+    void QuantizedPointStore::Reset(const glm::dvec3& scale, const glm::dvec3& offset, const glm::ivec3& rawMin, const glm::ivec3& rawMax, size_t count, bool hasColor) {
+        this->scale = scale;
+        this->offset = offset;
+        this->count = count;
+        shift = glm::vec3(0.f);
+        base = rawMin;
+        for (int axis = 0; axis < 3; ++axis) {
+            int64_t range = count == 0 ? 0 : int64_t(rawMax[axis]) - int64_t(rawMin[axis]);
+            widths[axis] = range < (int64_t(1) << 16) ? 2 : range < (int64_t(1) << 24) ? 3 : 4;
+            // Four spare bytes at the end let Decode always load a whole 32 bit word, even for the last point
+            columns[axis].assign(count * widths[axis] + 4, 0);
+        }
+        colors.assign(hasColor ? count * 3 : 0, 0);
+    }
+
+    void QuantizedPointStore::Clear() {
+        *this = QuantizedPointStore();
+    }
+
+    void QuantizedPointStore::SetPosition(size_t index, int32_t x, int32_t y, int32_t z) {
+        const int32_t raw[3] = { x, y, z };
+        for (int axis = 0; axis < 3; ++axis) {
+            // Writes land in little endian order, so only the low width bytes of the rebased value are kept
+            uint8_t* dst = columns[axis].data() + index * widths[axis];
+            uint32_t value = static_cast<uint32_t>(raw[axis]) - static_cast<uint32_t>(base[axis]);
+            std::memcpy(dst, &value, widths[axis]);
+        }
+    }
+
+    void QuantizedPointStore::SetColor(size_t index, uint16_t r, uint16_t g, uint16_t b) {
+        colors[index * 3] = r;
+        colors[index * 3 + 1] = g;
+        colors[index * 3 + 2] = b;
+    }
+
+    size_t QuantizedPointStore::MemoryUsage() const {
+        return columns[0].size() + columns[1].size() + columns[2].size() + colors.size() * sizeof(uint16_t);
+    }
+
+    void QuantizedPointStore::Decode(size_t first, size_t n, ColorVertex* out) const {
+        DecodeAt([&](size_t i) { return first + i; }, n, out);
+    }
+
+    void QuantizedPointStore::Decode(const uint32_t* indices, size_t n, ColorVertex* out) const {
+        DecodeAt([&](size_t i) { return static_cast<size_t>(indices[i]); }, n, out);
+    }
+
+    // Decodes point indexOf(i) into out[i] for i in [0, n)
+    template<typename IndexFn>
+    void QuantizedPointStore::DecodeAt(IndexFn&& indexOf, size_t n, ColorVertex* out) const {
+        constexpr size_t batchSize = 256;
+        int32_t raw[3][batchSize];
+        for (size_t done = 0; done < n; done += batchSize) {
+            size_t batch = std::min(batchSize, n - done);
+            for (int axis = 0; axis < 3; ++axis) {
+                const uint8_t* src = columns[axis].data();
+                const uint32_t mask = widths[axis] == 4 ? 0xFFFFFFFFu : (1u << (8 * widths[axis])) - 1;
+                for (size_t i = 0; i < batch; ++i) {
+                    uint32_t value;
+                    std::memcpy(&value, src + indexOf(done + i) * widths[axis], sizeof(value));
+                    raw[axis][i] = static_cast<int32_t>((value & mask) + static_cast<uint32_t>(base[axis]));
+                }
+            }
+            DequantizeWith(scale, offset, raw[0], raw[1], raw[2], batch, out + done);
+
+            for (size_t i = 0; i < batch; ++i) {
+                out[done + i].Pos -= shift;
+                if (!colors.empty()) {
+                    const uint16_t* rgb = colors.data() + indexOf(done + i) * 3;
+                    out[done + i].Color = glm::vec3(rgb[0] * 0.00001, rgb[1] * 0.00001, rgb[2] * 0.00001);
+                }
+                else {
+                    out[done + i].Color = glm::vec3(0.f, 1.f, 0.f);
+                }
+            }
+        }
+    }
+
+    // Copies one field out of the byte stream and advances past it
+    template<typename T>
+    static void ReadField(const char*& src, T& field) {
+        std::memcpy(&field, src, sizeof(field));
+        src += sizeof(field);
+    }
+
+    bool ReadLasHeader(const char* data, size_t size, lasHeader& header) {
+        // The las 1.0 header is the smallest one we understand
+        constexpr size_t minHeaderSize = 227;
+        if (data == nullptr || size < minHeaderSize || std::memcmp(data, "LASF", 4) != 0) {
+            return false;
+        }
+
+        const char* src = data;
+        ReadField(src, header.fileSignature);
+        ReadField(src, header.sourceID);
+        ReadField(src, header.globalEncoding);
+        ReadField(src, header.GUID1);
+        ReadField(src, header.GUID2);
+        ReadField(src, header.GUID3);
+        ReadField(src, header.GUID4);
+        ReadField(src, header.versionMajor);
+        ReadField(src, header.versionMinor);
+        ReadField(src, header.systemIdentifier);
+        ReadField(src, header.generatingSoftware);
+        ReadField(src, header.creationDay);
+        ReadField(src, header.creationYear);
+        ReadField(src, header.headerSize);
+        ReadField(src, header.offsetToPointData);
+        ReadField(src, header.numberVariableLengthRecords);
+        ReadField(src, header.pointDataRecordFormat);
+        ReadField(src, header.pointDataRecordLength);
+        ReadField(src, header.legacyNumberPointsRecords);
+        ReadField(src, header.legacyNumberPointReturn);
+        ReadField(src, header.xScaleFactor);
+        ReadField(src, header.yScaleFactor);
+        ReadField(src, header.zScaleFactor);
+        ReadField(src, header.xOffset);
+        ReadField(src, header.yOffset);
+        ReadField(src, header.zOffset);
+        ReadField(src, header.maxX);
+        ReadField(src, header.minX);
+        ReadField(src, header.maxY);
+        ReadField(src, header.minY);
+        ReadField(src, header.maxZ);
+        ReadField(src, header.minZ);
+
+        // Newer header versions append fields, older files leave them zeroed
+        header.startOfWaveformDataPacketRecord = 0;
+        header.startOfFirstExtendedVariableLengthRecord = 0;
+        header.numberOfExtendedVariableLengthRecords = 0;
+        header.numberOfPointRecords = 0;
+        std::memset(header.numberOfPointsByReturn, 0, sizeof(header.numberOfPointsByReturn));
+
+        // 1.3 header is 235 bytes, 1.4 is 375
+        size_t available = std::min<size_t>(size, header.headerSize);
+        if (available >= 235) {
+            ReadField(src, header.startOfWaveformDataPacketRecord);
+        }
+        if (available >= 375 && header.versionMinor >= 4) {
+            ReadField(src, header.startOfFirstExtendedVariableLengthRecord);
+            ReadField(src, header.numberOfExtendedVariableLengthRecords);
+            ReadField(src, header.numberOfPointRecords);
+            ReadField(src, header.numberOfPointsByReturn);
+        }
+        if (header.numberOfPointRecords == 0) {
+            header.numberOfPointRecords = static_cast<uint32_t>(header.legacyNumberPointsRecords);
+        }
+        return true;
+    }
+
+    lasPointData1 LasRecord::AsFormat1() const {
+        lasPointData1 out;
+        const char* src = data;
+        ReadField(src, out.xPos);
+        ReadField(src, out.yPos);
+        ReadField(src, out.zPos);
+        ReadField(src, out.intensity);
+        ReadField(src, out.flags);
+        ReadField(src, out.classificaton);
+        ReadField(src, out.scanAngle);
+        ReadField(src, out.userData);
+        ReadField(src, out.pointSourceID);
+        ReadField(src, out.GPSTime);
+        return out;
+    }
+
+    lasPointData2 LasRecord::AsFormat2() const {
+        lasPointData2 out;
+        const char* src = data;
+        ReadField(src, out.xPos);
+        ReadField(src, out.yPos);
+        ReadField(src, out.zPos);
+        ReadField(src, out.intensity);
+        ReadField(src, out.flags);
+        ReadField(src, out.classificaton);
+        ReadField(src, out.scanAngle);
+        ReadField(src, out.userData);
+        ReadField(src, out.pointSourceID);
+        ReadField(src, out.red);
+        ReadField(src, out.green);
+        ReadField(src, out.blue);
+        return out;
+    }
+
+    // LASzip decompression. This is a native port of the LASzip point-wise chunked
+    // decoder (compressor 2) with the version 2 POINT10, GPSTIME11, RGB12 and BYTE items,
+    // which is what LASzip writes for point formats 0-3. Every chunk starts with a raw
+    // point and resets all models, so chunks can be decoded independently.
+    namespace Laz {
+
+        constexpr uint32_t acMinLength = 0x01000000u;
+        constexpr uint32_t bmLengthShift = 13;
+        constexpr uint32_t bmMaxCount = 1u << bmLengthShift;
+        constexpr uint32_t dmLengthShift = 15;
+        constexpr uint32_t dmMaxCount = 1u << dmLengthShift;
+
+        enum ItemType : uint16_t {
+            Byte = 0,
+            Point10 = 6,
+            GpsTime11 = 7,
+            Rgb12 = 8
+        };
+
+        struct Item {
+            uint16_t type;
+            uint16_t size;
+            uint16_t version;
+        };
+
+        // Contents of the "laszip encoder" variable length record
+        struct Info {
+            uint16_t compressor{ 0 };
+            uint16_t coder{ 0 };
+            uint32_t chunkSize{ 0 };
+            std::vector<Item> items;
+        };
+
+        // Adaptive frequency model for multi-symbol alphabets
+        class SymbolModel {
+
+        public:
+            explicit SymbolModel(uint32_t symbols) : symbols(symbols) {
+                lastSymbol = symbols - 1;
+                // Large alphabets get a lookup table to speed up the decoder search
+                if (symbols > 16) {
+                    uint32_t tableBits = 3;
+                    while (symbols > (1u << (tableBits + 2))) {
+                        ++tableBits;
+                    }
+                    tableSize = 1u << tableBits;
+                    tableShift = dmLengthShift - tableBits;
+                    decoderTable.resize(tableSize + 2);
+                }
+                distribution.resize(symbols);
+                symbolCount.resize(symbols);
+                Init();
+            }
+
+            void Init() {
+                totalCount = 0;
+                updateCycle = symbols;
+                std::fill(symbolCount.begin(), symbolCount.end(), 1u);
+                Update();
+                symbolsUntilUpdate = updateCycle = (symbols + 6) >> 1;
+            }
+
+            void Update() {
+                // Halve counts when a threshold is reached
+                if ((totalCount += updateCycle) > dmMaxCount) {
+                    totalCount = 0;
+                    for (uint32_t n = 0; n < symbols; ++n) {
+                        totalCount += (symbolCount[n] = (symbolCount[n] + 1) >> 1);
+                    }
+                }
+
+                // Compute the cumulative distribution and decoder table
+                uint32_t sum = 0, s = 0;
+                uint32_t scale = 0x80000000u / totalCount;
+                if (tableSize == 0) {
+                    for (uint32_t k = 0; k < symbols; ++k) {
+                        distribution[k] = (scale * sum) >> (31 - dmLengthShift);
+                        sum += symbolCount[k];
+                    }
+                }
+                else {
+                    for (uint32_t k = 0; k < symbols; ++k) {
+                        distribution[k] = (scale * sum) >> (31 - dmLengthShift);
+                        sum += symbolCount[k];
+                        uint32_t w = distribution[k] >> tableShift;
+                        while (s < w) {
+                            decoderTable[++s] = k - 1;
+                        }
+                    }
+                    decoderTable[0] = 0;
+                    while (s <= tableSize) {
+                        decoderTable[++s] = symbols - 1;
+                    }
+                }
+
+                // Update less often as the model settles
+                updateCycle = (5 * updateCycle) >> 2;
+                uint32_t maxCycle = (symbols + 6) << 3;
+                if (updateCycle > maxCycle) {
+                    updateCycle = maxCycle;
+                }
+                symbolsUntilUpdate = updateCycle;
+            }
+
+            std::vector<uint32_t> distribution;
+            std::vector<uint32_t> symbolCount;
+            std::vector<uint32_t> decoderTable;
+            uint32_t symbols;
+            uint32_t lastSymbol{ 0 };
+            uint32_t tableSize{ 0 };
+            uint32_t tableShift{ 0 };
+            uint32_t totalCount{ 0 };
+            uint32_t updateCycle{ 0 };
+            uint32_t symbolsUntilUpdate{ 0 };
+        };
+
+        // Adaptive probability model for single bits
+        class BitModel {
+
+        public:
+            BitModel() { Init(); }
+
+            void Init() {
+                bit0Count = 1;
+                bitCount = 2;
+                bit0Prob = 1u << (bmLengthShift - 1);
+                updateCycle = bitsUntilUpdate = 4;
+            }
+
+            void Update() {
+                if ((bitCount += updateCycle) > bmMaxCount) {
+                    bitCount = (bitCount + 1) >> 1;
+                    bit0Count = (bit0Count + 1) >> 1;
+                    if (bit0Count == bitCount) {
+                        ++bitCount;
+                    }
+                }
+                uint32_t scale = 0x80000000u / bitCount;
+                bit0Prob = (bit0Count * scale) >> (31 - bmLengthShift);
+                updateCycle = (5 * updateCycle) >> 2;
+                if (updateCycle > 64) {
+                    updateCycle = 64;
+                }
+                bitsUntilUpdate = updateCycle;
+            }
+
+            uint32_t bit0Prob{ 0 };
+            uint32_t bit0Count{ 0 };
+            uint32_t bitCount{ 0 };
+            uint32_t updateCycle{ 0 };
+            uint32_t bitsUntilUpdate{ 0 };
+        };
+
+        // Range decoder over one compressed chunk. Reads past the end yield zeros instead of faulting.
+        class Decoder {
+
+        public:
+            void Init(const uint8_t* begin, const uint8_t* end) {
+                cur = begin;
+                last = end;
+                length = 0xFFFFFFFFu;
+                value = (uint32_t(NextByte()) << 24);
+                value |= (uint32_t(NextByte()) << 16);
+                value |= (uint32_t(NextByte()) << 8);
+                value |= uint32_t(NextByte());
+            }
+
+            uint32_t DecodeBit(BitModel& m) {
+                uint32_t x = m.bit0Prob * (length >> bmLengthShift);
+                uint32_t sym = (value >= x);
+                if (sym == 0) {
+                    length = x;
+                    ++m.bit0Count;
+                }
+                else {
+                    value -= x;
+                    length -= x;
+                }
+                if (length < acMinLength) {
+                    Renormalize();
+                }
+                if (--m.bitsUntilUpdate == 0) {
+                    m.Update();
+                }
+                return sym;
+            }
+
+            uint32_t DecodeSymbol(SymbolModel& m) {
+                uint32_t n, sym, x, y = length;
+                if (m.tableSize != 0) {
+                    uint32_t dv = value / (length >>= dmLengthShift);
+                    uint32_t t = dv >> m.tableShift;
+                    // Initial guess from the table, finished with a bisection search
+                    sym = m.decoderTable[t];
+                    n = m.decoderTable[t + 1] + 1;
+                    while (n > sym + 1) {
+                        uint32_t k = (sym + n) >> 1;
+                        if (m.distribution[k] > dv) {
+                            n = k;
+                        }
+                        else {
+                            sym = k;
+                        }
+                    }
+                    x = m.distribution[sym] * length;
+                    if (sym != m.lastSymbol) {
+                        y = m.distribution[sym + 1] * length;
+                    }
+                }
+                else {
+                    x = sym = 0;
+                    length >>= dmLengthShift;
+                    uint32_t k = (n = m.symbols) >> 1;
+                    do {
+                        uint32_t z = length * m.distribution[k];
+                        if (z > value) {
+                            n = k;
+                            y = z;
+                        }
+                        else {
+                            sym = k;
+                            x = z;
+                        }
+                    } while ((k = (sym + n) >> 1) != sym);
+                }
+
+                value -= x;
+                length = y - x;
+                if (length < acMinLength) {
+                    Renormalize();
+                }
+                ++m.symbolCount[sym];
+                if (--m.symbolsUntilUpdate == 0) {
+                    m.Update();
+                }
+                return sym;
+            }
+
+            uint32_t ReadBits(uint32_t bits) {
+                if (bits > 19) {
+                    uint32_t low = ReadShort();
+                    uint32_t high = ReadBits(bits - 16) << 16;
+                    return high | low;
+                }
+                uint32_t sym = value / (length >>= bits);
+                value -= length * sym;
+                if (length < acMinLength) {
+                    Renormalize();
+                }
+                return sym;
+            }
+
+            uint32_t ReadShort() {
+                uint32_t sym = value / (length >>= 16);
+                value -= length * sym;
+                if (length < acMinLength) {
+                    Renormalize();
+                }
+                return sym & 0xFFFFu;
+            }
+
+            uint32_t ReadInt() {
+                uint32_t low = ReadShort();
+                uint32_t high = ReadShort();
+                return (high << 16) | low;
+            }
+        private:
+            uint8_t NextByte() {
+                return cur < last ? *cur++ : 0;
+            }
+
+            void Renormalize() {
+                do {
+                    value = (value << 8) | NextByte();
+                } while ((length <<= 8) < acMinLength);
+            }
+
+            const uint8_t* cur{ nullptr };
+            const uint8_t* last{ nullptr };
+            uint32_t value{ 0 };
+            uint32_t length{ 0 };
+        };
+
+        // Decodes integers as a prediction plus an entropy coded corrector
+        class IntegerDecompressor {
+
+        public:
+            IntegerDecompressor(Decoder& dec, uint32_t bits, uint32_t contexts = 1, uint32_t bitsHigh = 8)
+                : dec(dec), bitsHigh(bitsHigh) {
+                if (bits != 0 && bits < 32) {
+                    corrBits = bits;
+                    corrRange = 1u << bits;
+                    corrMin = -static_cast<int32_t>(corrRange / 2);
+                }
+                else {
+                    corrBits = 32;
+                    corrRange = 0;
+                    corrMin = std::numeric_limits<int32_t>::min();
+                }
+
+                for (uint32_t i = 0; i < contexts; ++i) {
+                    mBits.emplace_back(corrBits + 1);
+                }
+                // Corrector k covers the interval of k bit correctors, zero and one use a bit model
+                for (uint32_t i = 1; i <= corrBits; ++i) {
+                    mCorrector.emplace_back(i <= bitsHigh ? 1u << i : 1u << bitsHigh);
+                }
+            }
+
+            int32_t Decompress(int32_t pred, uint32_t context = 0) {
+                // Wrap around in unsigned arithmetic like the encoder did
+                uint32_t real = static_cast<uint32_t>(pred) + static_cast<uint32_t>(ReadCorrector(mBits[context]));
+                if (corrRange != 0) {
+                    if (static_cast<int32_t>(real) < 0) {
+                        real += corrRange;
+                    }
+                    else if (real >= corrRange) {
+                        real -= corrRange;
+                    }
+                }
+                return static_cast<int32_t>(real);
+            }
+
+            uint32_t GetK() const { return k; }
+        private:
+            int32_t ReadCorrector(SymbolModel& bitsModel) {
+                int32_t c;
+                k = dec.DecodeSymbol(bitsModel);
+                if (k != 0) {
+                    if (k < 32) {
+                        if (k <= bitsHigh) {
+                            c = static_cast<int32_t>(dec.DecodeSymbol(mCorrector[k - 1]));
+                        }
+                        else {
+                            uint32_t k1 = k - bitsHigh;
+                            uint32_t high = dec.DecodeSymbol(mCorrector[k - 1]);
+                            uint32_t low = dec.ReadBits(k1);
+                            c = static_cast<int32_t>((high << k1) | low);
+                        }
+                        // Translate c back into its interval
+                        if (c >= static_cast<int32_t>(1u << (k - 1))) {
+                            c += 1;
+                        }
+                        else {
+                            c -= static_cast<int32_t>((uint64_t(1) << k) - 1);
+                        }
+                    }
+                    else {
+                        c = corrMin;
+                    }
+                }
+                else {
+                    c = static_cast<int32_t>(dec.DecodeBit(corrector0));
+                }
+                return c;
+            }
+
+            Decoder& dec;
+            uint32_t bitsHigh;
+            uint32_t corrBits;
+            uint32_t corrRange;
+            int32_t corrMin;
+            uint32_t k{ 0 };
+            std::vector<SymbolModel> mBits;
+            std::vector<SymbolModel> mCorrector;
+            BitModel corrector0;
+        };
+
+        // Running median of the last five values
+        class StreamingMedian5 {
+
+        public:
+            void Add(int32_t v) {
+                if (high) {
+                    if (v < values[2]) {
+                        values[4] = values[3];
+                        values[3] = values[2];
+                        if (v < values[0]) {
+                            values[2] = values[1];
+                            values[1] = values[0];
+                            values[0] = v;
+                        }
+                        else if (v < values[1]) {
+                            values[2] = values[1];
+                            values[1] = v;
+                        }
+                        else {
+                            values[2] = v;
+                        }
+                    }
+                    else {
+                        if (v < values[3]) {
+                            values[4] = values[3];
+                            values[3] = v;
+                        }
+                        else {
+                            values[4] = v;
+                        }
+                        high = false;
+                    }
+                }
+                else {
+                    if (values[2] < v) {
+                        values[0] = values[1];
+                        values[1] = values[2];
+                        if (values[4] < v) {
+                            values[2] = values[3];
+                            values[3] = values[4];
+                            values[4] = v;
+                        }
+                        else if (values[3] < v) {
+                            values[2] = values[3];
+                            values[3] = v;
+                        }
+                        else {
+                            values[2] = v;
+                        }
+                    }
+                    else {
+                        if (values[1] < v) {
+                            values[0] = values[1];
+                            values[1] = v;
+                        }
+                        else {
+                            values[0] = v;
+                        }
+                        high = true;
+                    }
+                }
+            }
+
+            int32_t Get() const { return values[2]; }
+        private:
+            int32_t values[5]{};
+            bool high{ true };
+        };
+
+        static uint8_t Fold(int32_t n) {
+            return static_cast<uint8_t>(n & 0xFF);
+        }
+
+        static int32_t Clamp(int32_t n) {
+            return n < 0 ? 0 : (n > 255 ? 255 : n);
+        }
+
+        // Reconstructs one item of a point from the previous point and the decoder
+        class ItemReader {
+
+        public:
+            virtual ~ItemReader() = default;
+            virtual void Init(const uint8_t* item) = 0;
+            virtual void Read(uint8_t* item) = 0;
+        };
+
+        class Point10Reader : public ItemReader {
+
+        public:
+            explicit Point10Reader(Decoder& dec)
+                : dec(dec), changedValues(64), intensity(dec, 16, 4), pointSourceID(dec, 16),
+                dx(dec, 32, 2), dy(dec, 32, 22), dz(dec, 32, 20) {
+                scanAngleRank.emplace_back(256);
+                scanAngleRank.emplace_back(256);
+            }
+
+            void Init(const uint8_t* item) override {
+                std::memcpy(last, item, 20);
+                // The intensity is predicted from zero
+                last[12] = 0;
+                last[13] = 0;
+            }
+
+            void Read(uint8_t* item) override {
+                static constexpr uint8_t numberReturnMap[8][8] = {
+                    { 15, 14, 13, 12, 11, 10,  9,  8 },
+                    { 14,  0,  1,  3,  6, 10, 10,  9 },
+                    { 13,  1,  2,  4,  7, 11, 11, 10 },
+                    { 12,  3,  4,  5,  8, 12, 12, 11 },
+                    { 11,  6,  7,  8,  9, 13, 13, 12 },
+                    { 10, 10, 11, 12, 13, 14, 14, 13 },
+                    {  9, 10, 11, 12, 13, 14, 15, 14 },
+                    {  8,  9, 10, 11, 12, 13, 14, 15 }
+                };
+
+                uint32_t changed = dec.DecodeSymbol(changedValues);
+                if (changed & 32) {
+                    last[14] = static_cast<uint8_t>(dec.DecodeSymbol(Model(bitByte, last[14])));
+                }
+
+                uint32_t r = last[14] & 0x7;
+                uint32_t n = (last[14] >> 3) & 0x7;
+                uint32_t m = numberReturnMap[n][r];
+                uint32_t l = static_cast<uint32_t>(std::abs(int(n) - int(r)));
+
+                if (changed != 0) {
+                    uint16_t value = lastIntensity[m];
+                    if (changed & 16) {
+                        value = static_cast<uint16_t>(intensity.Decompress(lastIntensity[m], m < 3 ? m : 3));
+                        lastIntensity[m] = value;
+                    }
+                    std::memcpy(last + 12, &value, 2);
+
+                    if (changed & 8) {
+                        last[15] = static_cast<uint8_t>(dec.DecodeSymbol(Model(classification, last[15])));
+                    }
+                    if (changed & 4) {
+                        uint32_t scanDirection = (last[14] >> 6) & 1;
+                        last[16] = Fold(int32_t(dec.DecodeSymbol(scanAngleRank[scanDirection])) + last[16]);
+                    }
+                    if (changed & 2) {
+                        last[17] = static_cast<uint8_t>(dec.DecodeSymbol(Model(userData, last[17])));
+                    }
+                    if (changed & 1) {
+                        uint16_t id;
+                        std::memcpy(&id, last + 18, 2);
+                        id = static_cast<uint16_t>(pointSourceID.Decompress(id));
+                        std::memcpy(last + 18, &id, 2);
+                    }
+                }
+
+                int32_t x, y, z;
+                std::memcpy(&x, last, 4);
+                std::memcpy(&y, last + 4, 4);
+
+                int32_t diff = dx.Decompress(xDiffMedian[m].Get(), n == 1);
+                x = static_cast<int32_t>(static_cast<uint32_t>(x) + static_cast<uint32_t>(diff));
+                xDiffMedian[m].Add(diff);
+
+                uint32_t kBits = dx.GetK();
+                diff = dy.Decompress(yDiffMedian[m].Get(), (n == 1) + (kBits < 20 ? (kBits & ~1u) : 20));
+                y = static_cast<int32_t>(static_cast<uint32_t>(y) + static_cast<uint32_t>(diff));
+                yDiffMedian[m].Add(diff);
+
+                kBits = (dx.GetK() + dy.GetK()) / 2;
+                z = dz.Decompress(lastHeight[l], (n == 1) + (kBits < 18 ? (kBits & ~1u) : 18));
+                lastHeight[l] = z;
+
+                std::memcpy(last, &x, 4);
+                std::memcpy(last + 4, &y, 4);
+                std::memcpy(last + 8, &z, 4);
+                std::memcpy(item, last, 20);
+            }
+        private:
+            // Context models keyed by the previous byte value are created on first use
+            SymbolModel& Model(std::vector<std::unique_ptr<SymbolModel>>& models, uint8_t previous) {
+                if (models.empty()) {
+                    models.resize(256);
+                }
+                if (!models[previous]) {
+                    models[previous] = std::make_unique<SymbolModel>(256);
+                }
+                return *models[previous];
+            }
+
+            Decoder& dec;
+            uint8_t last[20]{};
+            uint16_t lastIntensity[16]{};
+            StreamingMedian5 xDiffMedian[16];
+            StreamingMedian5 yDiffMedian[16];
+            int32_t lastHeight[8]{};
+
+            SymbolModel changedValues;
+            std::vector<SymbolModel> scanAngleRank;
+            std::vector<std::unique_ptr<SymbolModel>> bitByte;
+            std::vector<std::unique_ptr<SymbolModel>> classification;
+            std::vector<std::unique_ptr<SymbolModel>> userData;
+            IntegerDecompressor intensity;
+            IntegerDecompressor pointSourceID;
+            IntegerDecompressor dx;
+            IntegerDecompressor dy;
+            IntegerDecompressor dz;
+        };
+
+        class GpsTime11Reader : public ItemReader {
+
+        public:
+            explicit GpsTime11Reader(Decoder& dec)
+                : dec(dec), multiModel(multiTotal), zeroDiffModel(6), gpsTime(dec, 32, 9) {}
+
+            void Init(const uint8_t* item) override {
+                std::memcpy(&lastTime[0], item, 8);
+            }
+
+            void Read(uint8_t* item) override {
+                // Switching between the four tracked sequences re-reads with the new one
+                for (;;) {
+                    if (lastDiff[last] == 0) {
+                        uint32_t multi = dec.DecodeSymbol(zeroDiffModel);
+                        if (multi == 1) {
+                            lastDiff[last] = gpsTime.Decompress(0, 0);
+                            lastTime[last] += lastDiff[last];
+                            extremeCounter[last] = 0;
+                        }
+                        else if (multi == 2) {
+                            ReadFull();
+                        }
+                        else if (multi > 2) {
+                            last = (last + multi - 2) & 3;
+                            continue;
+                        }
+                    }
+                    else {
+                        uint32_t multi = dec.DecodeSymbol(multiModel);
+                        if (multi == 1) {
+                            lastTime[last] += gpsTime.Decompress(lastDiff[last], 1);
+                            extremeCounter[last] = 0;
+                        }
+                        else if (multi < multiUnchanged) {
+                            int32_t diff;
+                            if (multi == 0) {
+                                diff = gpsTime.Decompress(0, 7);
+                                CountExtreme(diff);
+                            }
+                            else if (multi < uint32_t(multiMax)) {
+                                diff = gpsTime.Decompress(Multiply(multi, lastDiff[last]), multi < 10 ? 2 : 3);
+                            }
+                            else if (multi == uint32_t(multiMax)) {
+                                diff = gpsTime.Decompress(Multiply(multiMax, lastDiff[last]), 4);
+                                CountExtreme(diff);
+                            }
+                            else {
+                                int32_t negative = int32_t(multiMax) - int32_t(multi);
+                                if (negative > multiMinus) {
+                                    diff = gpsTime.Decompress(Multiply(negative, lastDiff[last]), 5);
+                                }
+                                else {
+                                    diff = gpsTime.Decompress(Multiply(multiMinus, lastDiff[last]), 6);
+                                    CountExtreme(diff);
+                                }
+                            }
+                            lastTime[last] += diff;
+                        }
+                        else if (multi == multiCodeFull) {
+                            ReadFull();
+                        }
+                        else if (multi > multiCodeFull) {
+                            last = (last + multi - multiCodeFull) & 3;
+                            continue;
+                        }
+                    }
+                    break;
+                }
+                std::memcpy(item, &lastTime[last], 8);
+            }
+        private:
+            static constexpr int32_t multiMax = 500;
+            static constexpr int32_t multiMinus = -10;
+            static constexpr uint32_t multiUnchanged = multiMax - multiMinus + 1;
+            static constexpr uint32_t multiCodeFull = multiMax - multiMinus + 2;
+            static constexpr uint32_t multiTotal = multiMax - multiMinus + 6;
+
+            static int32_t Multiply(int32_t a, int32_t b) {
+                return static_cast<int32_t>(static_cast<uint32_t>(a) * static_cast<uint32_t>(b));
+            }
+
+            void CountExtreme(int32_t diff) {
+                if (++extremeCounter[last] > 3) {
+                    lastDiff[last] = diff;
+                    extremeCounter[last] = 0;
+                }
+            }
+
+            // The difference did not fit in 32 bits, so a new sequence starts from a full time stamp
+            void ReadFull() {
+                next = (next + 1) & 3;
+                int32_t highPrediction = static_cast<int32_t>(static_cast<uint64_t>(lastTime[last]) >> 32);
+                uint64_t high = static_cast<uint32_t>(gpsTime.Decompress(highPrediction, 8));
+                lastTime[next] = static_cast<int64_t>((high << 32) | dec.ReadInt());
+                last = next;
+                lastDiff[last] = 0;
+                extremeCounter[last] = 0;
+            }
+
+            Decoder& dec;
+            SymbolModel multiModel;
+            SymbolModel zeroDiffModel;
+            IntegerDecompressor gpsTime;
+            uint32_t last{ 0 };
+            uint32_t next{ 0 };
+            int64_t lastTime[4]{};
+            int32_t lastDiff[4]{};
+            int32_t extremeCounter[4]{};
+        };
+
+        class Rgb12Reader : public ItemReader {
+
+        public:
+            explicit Rgb12Reader(Decoder& dec) : dec(dec), byteUsed(128) {
+                for (int i = 0; i < 6; ++i) {
+                    diffModels.emplace_back(256);
+                }
+            }
+
+            void Init(const uint8_t* item) override {
+                std::memcpy(last, item, 6);
+            }
+
+            void Read(uint8_t* item) override {
+                uint16_t rgb[3];
+                uint32_t sym = dec.DecodeSymbol(byteUsed);
+
+                rgb[0] = (sym & 1) ? Fold(Corr(0) + (last[0] & 0xFF)) : (last[0] & 0xFF);
+                rgb[0] |= (sym & 2) ? Fold(Corr(1) + (last[0] >> 8)) << 8 : (last[0] & 0xFF00);
+
+                // Bit 6 is set when the channels differ, otherwise green and blue repeat red
+                if (sym & 64) {
+                    int32_t diff = (rgb[0] & 0xFF) - (last[0] & 0xFF);
+                    rgb[1] = (sym & 4) ? Fold(Corr(2) + Clamp(diff + (last[1] & 0xFF))) : (last[1] & 0xFF);
+                    if (sym & 16) {
+                        int32_t c = Corr(4);
+                        diff = (diff + ((rgb[1] & 0xFF) - (last[1] & 0xFF))) / 2;
+                        rgb[2] = Fold(c + Clamp(diff + (last[2] & 0xFF)));
+                    }
+                    else {
+                        rgb[2] = last[2] & 0xFF;
+                    }
+
+                    diff = (rgb[0] >> 8) - (last[0] >> 8);
+                    rgb[1] |= (sym & 8) ? Fold(Corr(3) + Clamp(diff + (last[1] >> 8))) << 8 : (last[1] & 0xFF00);
+                    if (sym & 32) {
+                        int32_t c = Corr(5);
+                        diff = (diff + ((rgb[1] >> 8) - (last[1] >> 8))) / 2;
+                        rgb[2] |= Fold(c + Clamp(diff + (last[2] >> 8))) << 8;
+                    }
+                    else {
+                        rgb[2] |= last[2] & 0xFF00;
+                    }
+                }
+                else {
+                    rgb[1] = rgb[0];
+                    rgb[2] = rgb[0];
+                }
+
+                std::memcpy(last, rgb, 6);
+                std::memcpy(item, rgb, 6);
+            }
+        private:
+            int32_t Corr(int channel) {
+                return static_cast<int32_t>(dec.DecodeSymbol(diffModels[channel]));
+            }
+
+            Decoder& dec;
+            SymbolModel byteUsed;
+            std::vector<SymbolModel> diffModels;
+            uint16_t last[3]{};
+        };
+
+        // Extra bytes, each predicted from the same byte of the previous point
+        class ByteReader : public ItemReader {
+
+        public:
+            ByteReader(Decoder& dec, size_t count) : dec(dec), last(count) {
+                for (size_t i = 0; i < count; ++i) {
+                    models.emplace_back(256);
+                }
+            }
+
+            void Init(const uint8_t* item) override {
+                std::memcpy(last.data(), item, last.size());
+            }
+
+            void Read(uint8_t* item) override {
+                for (size_t i = 0; i < last.size(); ++i) {
+                    last[i] = Fold(int32_t(last[i]) + int32_t(dec.DecodeSymbol(models[i])));
+                }
+                std::memcpy(item, last.data(), last.size());
+            }
+        private:
+            Decoder& dec;
+            std::vector<uint8_t> last;
+            std::vector<SymbolModel> models;
+        };
+
+        static bool IsSupported(const Info& info, size_t recordLength) {
+            if (info.compressor != 2 || info.coder != 0 || info.items.empty() || info.chunkSize == 0) {
+                return false;
+            }
+            size_t itemLength = 0;
+            for (const Item& item : info.items) {
+                itemLength += item.size;
+                bool known = (item.type == Point10 && item.size == 20)
+                    || (item.type == GpsTime11 && item.size == 8)
+                    || (item.type == Rgb12 && item.size == 6)
+                    || (item.type == Byte && item.size > 0);
+                if (!known || item.version != 2) {
+                    return false;
+                }
+            }
+            return itemLength == recordLength;
+        }
+
+        // Decodes one chunk of count points into raw, uncompressed point records
+        static bool DecodeChunk(const Info& info, const uint8_t* begin, const uint8_t* end, size_t count, size_t recordLength, uint8_t* out) {
+            if (count == 0) {
+                return true;
+            }
+            if (static_cast<size_t>(end - begin) < recordLength) {
+                return false;
+            }
+
+            Decoder dec;
+            std::vector<std::unique_ptr<ItemReader>> readers;
+            std::vector<size_t> offsets;
+            size_t offset = 0;
+            for (const Item& item : info.items) {
+                switch (item.type) {
+                case Point10: readers.push_back(std::make_unique<Point10Reader>(dec)); break;
+                case GpsTime11: readers.push_back(std::make_unique<GpsTime11Reader>(dec)); break;
+                case Rgb12: readers.push_back(std::make_unique<Rgb12Reader>(dec)); break;
+                default: readers.push_back(std::make_unique<ByteReader>(dec, item.size)); break;
+                }
+                offsets.push_back(offset);
+                offset += item.size;
+            }
+
+            // The first point of every chunk is stored raw
+            std::memcpy(out, begin, recordLength);
+            for (size_t i = 0; i < readers.size(); ++i) {
+                readers[i]->Init(out + offsets[i]);
+            }
+            dec.Init(begin + recordLength, end);
+
+            for (size_t p = 1; p < count; ++p) {
+                uint8_t* record = out + p * recordLength;
+                for (size_t i = 0; i < readers.size(); ++i) {
+                    readers[i]->Read(record + offsets[i]);
+                }
+            }
+            return true;
+        }
+
+        // Reads the arithmetic coded chunk table: byte offset of each chunk and, for variable chunks, its point count
+        static bool ReadChunkTable(const Info& info, const uint8_t* data, size_t size, size_t pointDataOffset, uint64_t pointCount,
+            std::vector<uint64_t>& chunkStarts, std::vector<uint64_t>& chunkCounts) {
+            if (pointDataOffset + 8 > size) {
+                return false;
+            }
+            int64_t tableOffset;
+            std::memcpy(&tableOffset, data + pointDataOffset, 8);
+            // Writers that could not seek back store the table offset at the end of the file instead
+            if (tableOffset == -1) {
+                std::memcpy(&tableOffset, data + size - 8, 8);
+            }
+            if (tableOffset < 0 || static_cast<uint64_t>(tableOffset) + 8 > size
+                || static_cast<uint64_t>(tableOffset) < pointDataOffset + 8) {
+                return false;
+            }
+
+            // Every chunk holds at least one point and one byte, which bounds a corrupt count before anything is allocated
+            uint32_t version, chunkCount;
+            std::memcpy(&version, data + tableOffset, 4);
+            std::memcpy(&chunkCount, data + tableOffset + 4, 4);
+            const uint64_t chunkBytes = static_cast<uint64_t>(tableOffset) - (pointDataOffset + 8);
+            if (version != 0 || chunkCount > pointCount || chunkCount > chunkBytes) {
+                return false;
+            }
+
+            bool variable = info.chunkSize == std::numeric_limits<uint32_t>::max();
+            chunkStarts.assign(static_cast<size_t>(chunkCount) + 1, 0);
+            chunkCounts.assign(static_cast<size_t>(chunkCount), info.chunkSize);
+            chunkStarts[0] = pointDataOffset + 8;
+
+            Decoder dec;
+            dec.Init(data + tableOffset + 8, data + size);
+            IntegerDecompressor ic(dec, 32, 2);
+            uint32_t lastCount = 0, lastBytes = 0;
+            for (uint32_t i = 0; i < chunkCount; ++i) {
+                if (variable) {
+                    lastCount = static_cast<uint32_t>(ic.Decompress(static_cast<int32_t>(lastCount), 0));
+                    chunkCounts[i] = lastCount;
+                }
+                lastBytes = static_cast<uint32_t>(ic.Decompress(static_cast<int32_t>(lastBytes), 1));
+                chunkStarts[i + 1] = chunkStarts[i] + lastBytes;
+                if (chunkStarts[i + 1] > static_cast<uint64_t>(tableOffset)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+    // Finds a variable length record by user id and record id, returning its payload
+    static bool FindVariableLengthRecord(const char* data, size_t size, const lasHeader& header,
+        const char* userID, uint16_t recordID, const char*& payload, uint16_t& length) {
+        constexpr size_t recordHeaderSize = 54;
+        size_t offset = header.headerSize;
+        for (uint32_t i = 0; i < header.numberVariableLengthRecords; ++i) {
+            if (offset + recordHeaderSize > size) {
+                return false;
+            }
+            lasVariableLengthRecords record;
+            const char* src = data + offset;
+            ReadField(src, record.lasReserved);
+            ReadField(src, record.UserID);
+            ReadField(src, record.recordID);
+            ReadField(src, record.recordLengthAfterHeader);
+            ReadField(src, record.lasDescription);
+
+            if (offset + recordHeaderSize + record.recordLengthAfterHeader > size) {
+                return false;
+            }
+            if (record.recordID == recordID && std::strncmp(record.UserID, userID, sizeof(record.UserID)) == 0) {
+                payload = src;
+                length = record.recordLengthAfterHeader;
+                return true;
+            }
+            offset += recordHeaderSize + record.recordLengthAfterHeader;
+        }
+        return false;
+    }
+
+    static bool ReadLazInfo(const char* data, size_t size, const lasHeader& header, Laz::Info& info) {
+        const char* payload = nullptr;
+        uint16_t length = 0;
+        if (!FindVariableLengthRecord(data, size, header, "laszip encoder", 22204, payload, length) || length < 34) {
+            return false;
+        }
+
+        uint8_t versionMajor, versionMinor;
+        uint16_t revision, itemCount;
+        uint32_t options;
+        int64_t specialRecords, specialOffset;
+        ReadField(payload, info.compressor);
+        ReadField(payload, info.coder);
+        ReadField(payload, versionMajor);
+        ReadField(payload, versionMinor);
+        ReadField(payload, revision);
+        ReadField(payload, options);
+        ReadField(payload, info.chunkSize);
+        ReadField(payload, specialRecords);
+        ReadField(payload, specialOffset);
+        ReadField(payload, itemCount);
+        if (length < 34 + itemCount * 6) {
+            return false;
+        }
+        info.items.resize(itemCount);
+        for (Laz::Item& item : info.items) {
+            ReadField(payload, item.type);
+            ReadField(payload, item.size);
+            ReadField(payload, item.version);
+        }
+        return true;
+    }
+
+    void LasLoader::ReadLaz(const std::string& path) {
+        MappedFile file(path);
+        lasHeader header;
+        if (!ReadLasHeader(file.Data(), file.Size(), header)) {
+            std::cout << "Cant open file: " << path << std::endl;
+            return;
+        }
+        SetBoundsFromHeader(header);
+
+        // The top bits of the format mark compressed points
+        header.pointDataRecordFormat &= 0x3F;
+        Laz::Info info;
+        if (!ReadLazInfo(file.Data(), file.Size(), header, info) || !Laz::IsSupported(info, header.pointDataRecordLength)
+            || !IsLasFormatSupported(header)) {
+            std::cout << "Unsupported laz compression: " << path << std::endl;
+            return;
+        }
+
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(file.Data());
+        std::vector<uint64_t> chunkStarts;
+        std::vector<uint64_t> chunkCounts;
+        if (!Laz::ReadChunkTable(info, data, file.Size(), header.offsetToPointData, header.numberOfPointRecords, chunkStarts, chunkCounts)) {
+            std::cout << "Corrupt laz chunk table: " << path << std::endl;
+            return;
+        }
+
+        // The table has to account for every point in the header. Fixed size chunks leave only the last one short,
+        // variable ones add up exactly, and a count past what the chunks hold would decode garbage.
+        uint64_t tablePoints = 0;
+        for (uint64_t count : chunkCounts) {
+            tablePoints += count;
+        }
+        const bool variable = info.chunkSize == std::numeric_limits<uint32_t>::max();
+        if (tablePoints < header.numberOfPointRecords
+            || (variable ? tablePoints != header.numberOfPointRecords : !chunkCounts.empty() && tablePoints - info.chunkSize >= header.numberOfPointRecords)) {
+            std::cout << "Corrupt laz chunk table: " << path << std::endl;
+            return;
+        }
+
+        // Point index of the first point in each chunk, the last chunk may be short
+        const size_t total = static_cast<size_t>(std::min(header.numberOfPointRecords, tablePoints));
+        std::vector<size_t> chunkFirst(chunkCounts.size() + 1, total);
+        size_t first = 0;
+        for (size_t i = 0; i < chunkCounts.size(); ++i) {
+            chunkFirst[i] = std::min(first, total);
+            first += static_cast<size_t>(chunkCounts[i]);
+        }
+
+        const size_t recordLength = header.pointDataRecordLength;
+        const PointFilterTable filter(settings.filter);
+        std::vector<size_t> chunkKept(chunkCounts.size(), 0);
+        PointData.Resize(total);
+        std::atomic<bool> failed{ false };
+        ParallelFor(chunkCounts.size(), settings.threadCount, 1, [&](size_t begin, size_t end) {
+            std::vector<uint8_t> records;
+            for (size_t chunk = begin; chunk < end && !failed; ++chunk) {
+                size_t count = chunkFirst[chunk + 1] - chunkFirst[chunk];
+                records.resize(count * recordLength);
+                if (!Laz::DecodeChunk(info, data + chunkStarts[chunk], data + chunkStarts[chunk + 1], count, recordLength, records.data())) {
+                    failed = true;
+                    break;
+                }
+                chunkKept[chunk] = DecodeBlock(header, reinterpret_cast<const char*>(records.data()), count, filter.Get(),
+                    { nullptr, &PointData, chunkFirst[chunk], chunkFirst[chunk] }, nullptr);
+            }
+        });
+
+        if (failed) {
+            std::cout << "Corrupt laz chunk: " << path << std::endl;
+            PointData.Clear();
+            return;
+        }
+        CompactSlices(PointData, chunkFirst, chunkKept);
+    }
+
+    LasPointStream::LasPointStream(const std::string& path, size_t batchSize)
+        : file(path, std::ios::binary), batchSize(std::max<size_t>(batchSize, 1)) {
+        if (!file.is_open()) {
+            return;
+        }
+
+        char headerBytes[lasHeaderMaxSize];
+        file.read(headerBytes, sizeof(headerBytes));
+        if (!ReadLasHeader(headerBytes, static_cast<size_t>(file.gcount()), header)) {
+            return;
+        }
+        file.clear();
+        file.seekg(header.offsetToPointData);
+        valid = true;
+    }
+
+    size_t LasPointStream::Read(ColorVertex* out, size_t maxPoints) {
+        if (!valid || !IsLasFormatSupported(header)) {
+            return 0;
+        }
+
+        // Read whole blocks of records at once and unpack them from the buffer
+        const size_t stride = header.pointDataRecordLength;
+        uint64_t remaining = header.numberOfPointRecords - pointsRead;
+        size_t wanted = static_cast<size_t>(std::min<uint64_t>({ maxPoints, batchSize, remaining }));
+        if (wanted == 0) {
+            return 0;
+        }
+        buffer.resize(wanted * stride);
+
+        // Keep reading while the filter rejects whole batches, 0 has to mean the end of the file
+        PointFilterTable table(filter);
+        while (true) {
+            file.read(buffer.data(), wanted * stride);
+            size_t got = static_cast<size_t>(file.gcount()) / stride;
+            size_t kept = DecodeBlock(header, buffer.data(), got, table.Get(), { out }, nullptr);
+
+            // A truncated file ends the stream early
+            pointsRead += got;
+            if (got < wanted) {
+                valid = false;
+            }
+            remaining -= got;
+            wanted = static_cast<size_t>(std::min<uint64_t>(wanted, remaining));
+            if (kept != 0 || !valid || wanted == 0) {
+                return kept;
+            }
+        }
+    }
+
+    bool LasPointStream::Next(std::vector<ColorVertex>& batch) {
+        batch.resize(batchSize);
+        batch.resize(Read(batch.data(), batch.size()));
+        return !batch.empty();
+    }
+
+    uint64_t StreamLas(const std::string& path, size_t batchSize, const std::function<void(const ColorVertex*, size_t)>& onBatch) {
+        LasPointStream stream(path, batchSize);
+        std::vector<ColorVertex> batch;
+        while (stream.Next(batch)) {
+            onBatch(batch.data(), batch.size());
+        }
+        return stream.PointsRead();
+    }
+
+    LasFile::LasFile(const std::string& path) : file(path) {
+        valid = ReadLasHeader(file.Data(), file.Size(), header);
+    }
+
+    LasPointView LasFile::Points() const {
+        if (!valid || header.pointDataRecordLength == 0 || header.offsetToPointData > file.Size()) {
+            return {};
+        }
+
+        // Never trust the header count further than the file actually reaches
+        size_t available = (file.Size() - header.offsetToPointData) / header.pointDataRecordLength;
+        size_t count = static_cast<size_t>(header.numberOfPointRecords);
+        if (count > available) {
+            count = available;
+        }
+        return LasPointView(file.Data() + header.offsetToPointData, count, header.pointDataRecordLength);
+    }
+
+    MappedFile::MappedFile(const std::string& path) {
+#ifdef _WIN32
+        HANDLE fh = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (fh == INVALID_HANDLE_VALUE) {
+            return;
+        }
+        LARGE_INTEGER fileSize{};
+        if (!GetFileSizeEx(fh, &fileSize) || fileSize.QuadPart == 0) {
+            CloseHandle(fh);
+            return;
+        }
+        HANDLE mh = CreateFileMappingA(fh, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mh == nullptr) {
+            CloseHandle(fh);
+            return;
+        }
+        void* view = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+        if (view == nullptr) {
+            CloseHandle(mh);
+            CloseHandle(fh);
+            return;
+        }
+        fileHandle = fh;
+        mappingHandle = mh;
+        data = static_cast<const char*>(view);
+        size = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st {};
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return;
+        }
+        void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        // The mapping keeps its own reference to the file
+        close(fd);
+        if (view == MAP_FAILED) {
+            return;
+        }
+        madvise(view, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+        data = static_cast<const char*>(view);
+        size = static_cast<size_t>(st.st_size);
+#endif
+    }
+
+    MappedFile::~MappedFile() {
+        Close();
+    }
+
+    MappedFile::MappedFile(MappedFile&& other) noexcept {
+        *this = std::move(other);
+    }
+
+    MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            Close();
+            std::swap(data, other.data);
+            std::swap(size, other.size);
+#ifdef _WIN32
+            std::swap(fileHandle, other.fileHandle);
+            std::swap(mappingHandle, other.mappingHandle);
+#endif
+        }
+        return *this;
+    }
+
+    void MappedFile::Close() {
+        if (data == nullptr) {
+            return;
+        }
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+        CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+        fileHandle = nullptr;
+        mappingHandle = nullptr;
+#else
+        munmap(const_cast<char*>(data), size);
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+    // Leaves are split until they hold at most this many points or reach the deepest level
+    constexpr uint64_t lasIndexLeafPoints = 1 << 14;
+    constexpr uint32_t lasIndexMaxLevel = 10;
+    // Records of the same leaf this close together share one range, trading a few extra decodes for fewer ranges
+    constexpr uint64_t lasIndexMergeGap = 32;
+    constexpr uint32_t lasIndexVersion = 1;
+    constexpr char lasIndexSignature[8] = { 'L', 'A', 'S', 'I', 'D', 'X', 0, 0 };
+
+    struct lasIndexHeader {
+        char signature[8];
+        uint32_t version;
+        uint32_t offsetToPointData;
+        uint64_t pointCount;
+        double minX;
+        double minY;
+        double maxX;
+        double maxY;
+        uint32_t recordLength;
+        uint32_t cellCount;
+        uint64_t rangeCount;
+    };
+
+    static uint32_t InterleaveBits(uint32_t value) {
+        value &= 0x0000FFFF;
+        value = (value | (value << 8)) & 0x00FF00FF;
+        value = (value | (value << 4)) & 0x0F0F0F0F;
+        value = (value | (value << 2)) & 0x33333333;
+        value = (value | (value << 1)) & 0x55555555;
+        return value;
+    }
+
+    static uint32_t DeinterleaveBits(uint32_t value) {
+        value &= 0x55555555;
+        value = (value | (value >> 1)) & 0x33333333;
+        value = (value | (value >> 2)) & 0x0F0F0F0F;
+        value = (value | (value >> 4)) & 0x00FF00FF;
+        value = (value | (value >> 8)) & 0x0000FFFF;
+        return value;
+    }
+
+    void LasSpatialIndex::Build(const lasHeader& header, const char* records, uint64_t recordCount) {
+        minX = header.minX;
+        minY = header.minY;
+        maxX = header.maxX;
+        maxY = header.maxY;
+        pointCount = records != nullptr ? recordCount : 0;
+        offsetToPointData = header.offsetToPointData;
+        recordLength = header.pointDataRecordLength;
+        cells.clear();
+        ranges.clear();
+
+        // Morton code of the deepest level cell of every record, points outside the header bounds go to the edge
+        const uint32_t gridSize = 1u << lasIndexMaxLevel;
+        const double cellsPerX = maxX > minX ? gridSize / (maxX - minX) : 0.0;
+        const double cellsPerY = maxY > minY ? gridSize / (maxY - minY) : 0.0;
+        auto codeOf = [&](uint64_t i) {
+            LasRecord record(records + i * recordLength);
+            double x = record.X() * header.xScaleFactor + header.xOffset;
+            double y = record.Y() * header.yScaleFactor + header.yOffset;
+            double cellX = std::clamp((x - minX) * cellsPerX, 0.0, double(gridSize - 1));
+            double cellY = std::clamp((y - minY) * cellsPerY, 0.0, double(gridSize - 1));
+            return InterleaveBits(static_cast<uint32_t>(cellX)) | (InterleaveBits(static_cast<uint32_t>(cellY)) << 1);
+        };
+
+        std::vector<uint64_t> codeStart(size_t(gridSize) * gridSize + 1, 0);
+        for (uint64_t i = 0; i < pointCount; ++i) {
+            codeStart[codeOf(i) + 1]++;
+        }
+        for (size_t i = 1; i < codeStart.size(); ++i) {
+            codeStart[i] += codeStart[i - 1];
+        }
+
+        // Children of a node cover consecutive Morton codes, so splitting is just quartering the code range
+        std::vector<uint32_t> leafOfCode(size_t(gridSize) * gridSize, 0);
+        std::function<void(uint32_t, uint32_t)> split = [&](uint32_t level, uint32_t firstCode) {
+            uint32_t codeCount = 1u << (2 * (lasIndexMaxLevel - level));
+            uint64_t points = codeStart[firstCode + codeCount] - codeStart[firstCode];
+            if (points == 0) {
+                return;
+            }
+            if (points > lasIndexLeafPoints && level < lasIndexMaxLevel) {
+                for (uint32_t child = 0; child < 4; ++child) {
+                    split(level + 1, firstCode + child * codeCount / 4);
+                }
+                return;
+            }
+            uint32_t code = firstCode >> (2 * (lasIndexMaxLevel - level));
+            std::fill_n(leafOfCode.begin() + firstCode, codeCount, static_cast<uint32_t>(cells.size()));
+            cells.push_back({ level, DeinterleaveBits(code), DeinterleaveBits(code >> 1), 0, 0 });
+        };
+        split(0, 0);
+
+        // Runs of records per leaf, in file order
+        std::vector<std::vector<LasRecordRange>> leafRanges(cells.size());
+        for (uint64_t i = 0; i < pointCount; ++i) {
+            auto& runs = leafRanges[leafOfCode[codeOf(i)]];
+            if (!runs.empty() && i - runs.back().last <= lasIndexMergeGap) {
+                runs.back().last = i + 1;
+            }
+            else {
+                runs.push_back({ i, i + 1 });
+            }
+        }
+        for (size_t i = 0; i < cells.size(); ++i) {
+            cells[i].firstRange = static_cast<uint32_t>(ranges.size());
+            cells[i].rangeCount = static_cast<uint32_t>(leafRanges[i].size());
+            ranges.insert(ranges.end(), leafRanges[i].begin(), leafRanges[i].end());
+        }
+        built = true;
+    }
+
+    bool LasSpatialIndex::Load(const std::string& path, const lasHeader& header, uint64_t recordCount) {
+        MappedFile file(path);
+        lasIndexHeader indexHeader;
+        if (!file.IsOpen() || file.Size() < sizeof(indexHeader)) {
+            return false;
+        }
+        std::memcpy(&indexHeader, file.Data(), sizeof(indexHeader));
+
+        // An index built for another version of the las file is as good as none
+        if (std::memcmp(indexHeader.signature, lasIndexSignature, sizeof(indexHeader.signature)) != 0
+            || indexHeader.version != lasIndexVersion
+            || indexHeader.pointCount != recordCount
+            || indexHeader.offsetToPointData != header.offsetToPointData
+            || indexHeader.recordLength != header.pointDataRecordLength
+            || indexHeader.minX != header.minX || indexHeader.minY != header.minY
+            || indexHeader.maxX != header.maxX || indexHeader.maxY != header.maxY) {
+            return false;
+        }
+        const char* src = file.Data() + sizeof(indexHeader);
+        const char* end = file.Data() + file.Size();
+        if (!ReadArray(src, end, indexHeader.cellCount, cells) || !ReadArray(src, end, indexHeader.rangeCount, ranges)) {
+            cells.clear();
+            ranges.clear();
+            return false;
+        }
+        for (const Cell& cell : cells) {
+            if (cell.level > lasIndexMaxLevel || uint64_t(cell.firstRange) + cell.rangeCount > ranges.size()) {
+                cells.clear();
+                ranges.clear();
+                return false;
+            }
+        }
+        // Queries index the records straight from these, so none may reach past the file
+        for (const LasRecordRange& range : ranges) {
+            if (range.first >= range.last || range.last > recordCount) {
+                cells.clear();
+                ranges.clear();
+                return false;
+            }
+        }
+
+        minX = indexHeader.minX;
+        minY = indexHeader.minY;
+        maxX = indexHeader.maxX;
+        maxY = indexHeader.maxY;
+        pointCount = indexHeader.pointCount;
+        offsetToPointData = indexHeader.offsetToPointData;
+        recordLength = static_cast<uint16_t>(indexHeader.recordLength);
+        built = true;
+        return true;
+    }
+
+    bool LasSpatialIndex::Save(const std::string& path) const {
+        if (!built) {
+            return false;
+        }
+        lasIndexHeader indexHeader{};
+        std::memcpy(indexHeader.signature, lasIndexSignature, sizeof(indexHeader.signature));
+        indexHeader.version = lasIndexVersion;
+        indexHeader.offsetToPointData = offsetToPointData;
+        indexHeader.pointCount = pointCount;
+        indexHeader.minX = minX;
+        indexHeader.minY = minY;
+        indexHeader.maxX = maxX;
+        indexHeader.maxY = maxY;
+        indexHeader.recordLength = recordLength;
+        indexHeader.cellCount = static_cast<uint32_t>(cells.size());
+        indexHeader.rangeCount = ranges.size();
+
+        std::ofstream os(path, std::ios::binary | std::ios::trunc);
+        if (!os.is_open()) {
+            return false;
+        }
+        os.write(reinterpret_cast<const char*>(&indexHeader), sizeof(indexHeader));
+        os.write(reinterpret_cast<const char*>(cells.data()), cells.size() * sizeof(Cell));
+        os.write(reinterpret_cast<const char*>(ranges.data()), ranges.size() * sizeof(LasRecordRange));
+        return os.good();
+    }
+
+    void LasSpatialIndex::GetCellBounds(const Cell& cell, double& cellMinX, double& cellMinY, double& cellMaxX, double& cellMaxY) const {
+        const double cellsAtLevel = double(1u << cell.level);
+        const double width = (maxX - minX) / cellsAtLevel;
+        const double height = (maxY - minY) / cellsAtLevel;
+        cellMinX = minX + cell.x * width;
+        cellMinY = minY + cell.y * height;
+        cellMaxX = cellMinX + width;
+        cellMaxY = cellMinY + height;
+
+        // Edge cells also hold the points that lay outside the header bounds
+        const double infinity = std::numeric_limits<double>::infinity();
+        const uint32_t last = (1u << cell.level) - 1;
+        if (cell.x == 0) cellMinX = -infinity;
+        if (cell.y == 0) cellMinY = -infinity;
+        if (cell.x == last) cellMaxX = infinity;
+        if (cell.y == last) cellMaxY = infinity;
+    }
+
+    std::vector<LasRecordRange> LasSpatialIndex::Query(double queryMinX, double queryMinY, double queryMaxX, double queryMaxY) const {
+        // Points are compared as floats after decoding, so widen the box by one deepest cell
+        const double marginX = (maxX - minX) / (1u << lasIndexMaxLevel);
+        const double marginY = (maxY - minY) / (1u << lasIndexMaxLevel);
+        queryMinX -= marginX;
+        queryMinY -= marginY;
+        queryMaxX += marginX;
+        queryMaxY += marginY;
+
+        std::vector<LasRecordRange> hits;
+        for (const Cell& cell : cells) {
+            double cellMinX, cellMinY, cellMaxX, cellMaxY;
+            GetCellBounds(cell, cellMinX, cellMinY, cellMaxX, cellMaxY);
+            if (cellMaxX < queryMinX || cellMinX > queryMaxX || cellMaxY < queryMinY || cellMinY > queryMaxY) {
+                continue;
+            }
+            hits.insert(hits.end(), ranges.begin() + cell.firstRange, ranges.begin() + cell.firstRange + cell.rangeCount);
+        }
+
+        // Neighbouring leaves often interleave in file order, merge them into as few reads as possible
+        std::sort(hits.begin(), hits.end(), [](const LasRecordRange& a, const LasRecordRange& b) { return a.first < b.first; });
+        std::vector<LasRecordRange> merged;
+        for (const auto& range : hits) {
+            if (!merged.empty() && range.first <= merged.back().last + lasIndexMergeGap) {
+                merged.back().last = std::max(merged.back().last, range.last);
+            }
+            else {
+                merged.push_back(range);
+            }
+        }
+        return merged;
+    }
+
+    std::vector<std::string> FindPointFiles(const std::string& directory) {
+        // Only the lower case extensions LasLoader dispatches on
+        std::vector<std::string> files;
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+            std::string extension = entry.path().extension().string();
+            if (entry.is_regular_file(error) && (extension == ".las" || extension == ".laz" || extension == ".lasbin" || extension == ".txt")) {
+                files.push_back(entry.path().string());
+            }
+        }
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    // Size of the header in front of each variable length record, and of each extended one
+    constexpr size_t lasVlrHeaderSize = 54;
+    constexpr size_t lasEvlrHeaderSize = 60;
+
+    static std::string FixedString(const char* chars, size_t size) {
+        return std::string(chars, strnlen(chars, size));
+    }
+
+    // Fills info from the start of the file, seeking only to the VLR and EVLR headers
+    static void ScanLasFile(const std::string& path, bool readVlrs, LasFileInfo& info) {
+        info.path = path;
+        std::ifstream is(path, std::ios::binary | std::ios::ate);
+        if (!is.is_open()) {
+            return;
+        }
+        info.fileSize = static_cast<uint64_t>(is.tellg());
+        is.seekg(0);
+
+        char headerBytes[lasHeaderMaxSize];
+        is.read(headerBytes, sizeof(headerBytes));
+        if (!ReadLasHeader(headerBytes, static_cast<size_t>(is.gcount()), info.header)) {
+            return;
+        }
+        info.valid = true;
+        info.compressed = (info.header.pointDataRecordFormat & 0xC0) != 0;
+        info.header.pointDataRecordFormat &= 0x3F;
+        if (!readVlrs) {
+            return;
+        }
+
+        // The VLRs sit between the header and the point data, so they come in with one read
+        const lasHeader& header = info.header;
+        uint64_t vlrEnd = std::min<uint64_t>(header.offsetToPointData, info.fileSize);
+        if (header.numberVariableLengthRecords > 0 && vlrEnd > header.headerSize) {
+            std::vector<char> bytes(static_cast<size_t>(vlrEnd - header.headerSize));
+            is.clear();
+            is.seekg(header.headerSize);
+            is.read(bytes.data(), bytes.size());
+            size_t size = static_cast<size_t>(is.gcount());
+            size_t offset = 0;
+            for (uint32_t i = 0; i < header.numberVariableLengthRecords && offset + lasVlrHeaderSize <= size; ++i) {
+                lasVariableLengthRecords record;
+                const char* src = bytes.data() + offset;
+                ReadField(src, record.lasReserved);
+                ReadField(src, record.UserID);
+                ReadField(src, record.recordID);
+                ReadField(src, record.recordLengthAfterHeader);
+                ReadField(src, record.lasDescription);
+                info.vlrs.push_back({ FixedString(record.UserID, sizeof(record.UserID)), record.recordID,
+                    record.recordLengthAfterHeader, FixedString(record.lasDescription, sizeof(record.lasDescription)), false });
+                offset += lasVlrHeaderSize + record.recordLengthAfterHeader;
+            }
+        }
+
+        // Extended VLRs follow the points and can be large, so only their headers are read
+        uint64_t offset = header.startOfFirstExtendedVariableLengthRecord;
+        for (uint32_t i = 0; i < header.numberOfExtendedVariableLengthRecords && offset != 0
+            && offset + lasEvlrHeaderSize <= info.fileSize; ++i) {
+            char bytes[lasEvlrHeaderSize];
+            is.clear();
+            is.seekg(offset);
+            if (!is.read(bytes, sizeof(bytes))) {
+                break;
+            }
+            uint16_t reserved;
+            char userID[16];
+            LasVlrInfo vlr;
+            char description[32];
+            const char* src = bytes;
+            ReadField(src, reserved);
+            ReadField(src, userID);
+            ReadField(src, vlr.recordID);
+            ReadField(src, vlr.length);
+            ReadField(src, description);
+            vlr.userID = FixedString(userID, sizeof(userID));
+            vlr.description = FixedString(description, sizeof(description));
+            vlr.extended = true;
+            info.vlrs.push_back(vlr);
+            offset += lasEvlrHeaderSize + vlr.length;
+        }
+    }
+
+    std::vector<LasFileInfo> ScanLasFiles(const std::vector<std::string>& paths, bool readVlrs, unsigned int threadCount) {
+        // Each file costs an open and a couple of small reads, so hand them out in batches
+        constexpr size_t minFilesPerThread = 64;
+        std::vector<LasFileInfo> infos(paths.size());
+        ParallelFor(paths.size(), threadCount, minFilesPerThread, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                ScanLasFile(paths[i], readVlrs, infos[i]);
+            }
+        });
+        return infos;
+    }
+
+    std::string LasIndexPath(const std::string& lasPath) {
+        return std::filesystem::path(lasPath).replace_extension(".lasidx").string();
+    }
+
+    struct AsyncBlockReader::Backend {
+        virtual ~Backend() = default;
+        virtual bool UsesIoUring() const = 0;
+        virtual size_t Next(const char*& data) = 0;
+
+        uint64_t offset{ 0 };
+        uint64_t length{ 0 };
+        size_t blockSize{ 0 };
+        unsigned int depth{ 0 };
+        uint64_t blockCount{ 0 };
+        // One buffer per read in flight, block i always lands in buffer i % depth
+        std::vector<char> buffers;
+
+        void Init(uint64_t rangeOffset, uint64_t rangeLength, size_t size, unsigned int slots) {
+            offset = rangeOffset;
+            length = rangeLength;
+            blockSize = size;
+            depth = slots;
+            blockCount = (length + blockSize - 1) / blockSize;
+            buffers.resize(blockSize * depth);
+        }
+        char* Buffer(uint64_t block) { return buffers.data() + (block % depth) * blockSize; }
+        size_t BlockLength(uint64_t block) const { return static_cast<size_t>(std::min<uint64_t>(blockSize, length - block * blockSize)); }
+    };
+
+    // A single thread reads ahead into the free buffers while the caller works on the filled ones
+    struct ThreadBlockReader : AsyncBlockReader::Backend {
+        std::ifstream file;
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable changed;
+        uint64_t filled{ 0 };
+        uint64_t released{ 0 };
+        uint64_t returned{ 0 };
+        bool failed{ false };
+        bool stopping{ false };
+
+        bool Open(const std::string& path) {
+            file.open(path, std::ios::binary);
+            if (!file.is_open()) {
+                return false;
+            }
+            worker = std::thread([this] { Run(); });
+            return true;
+        }
+
+        ~ThreadBlockReader() override {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            changed.notify_all();
+            if (worker.joinable()) {
+                worker.join();
+            }
+        }
+
+        bool UsesIoUring() const override { return false; }
+
+        void Run() {
+            for (uint64_t block = 0; block < blockCount; ++block) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    changed.wait(lock, [&] { return stopping || block - released < depth; });
+                    if (stopping) {
+                        return;
+                    }
+                }
+                size_t bytes = BlockLength(block);
+                file.seekg(static_cast<std::streamoff>(offset + block * blockSize));
+                file.read(Buffer(block), static_cast<std::streamsize>(bytes));
+                bool ok = static_cast<size_t>(file.gcount()) == bytes;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (ok) {
+                        ++filled;
+                    }
+                    else {
+                        failed = true;
+                    }
+                }
+                changed.notify_all();
+                if (!ok) {
+                    return;
+                }
+            }
+        }
+
+        size_t Next(const char*& data) override {
+            std::unique_lock<std::mutex> lock(mutex);
+            // The block handed out last time is done with, so its buffer can be refilled
+            if (returned > released) {
+                released = returned;
+                changed.notify_all();
+            }
+            if (returned == blockCount) {
+                return 0;
+            }
+            changed.wait(lock, [&] { return failed || filled > returned; });
+            if (filled <= returned) {
+                return AsyncBlockReader::readFailed;
+            }
+            data = Buffer(returned);
+            return BlockLength(returned++);
+        }
+    };
+
+#ifdef LAS_IO_URING
+    // Submission and completion rings shared with the kernel
+    struct UringBlockReader : AsyncBlockReader::Backend {
+        int ringFd{ -1 };
+        int fileFd{ -1 };
+        void* sqRing{ MAP_FAILED };
+        void* cqRing{ MAP_FAILED };
+        size_t sqRingSize{ 0 };
+        size_t cqRingSize{ 0 };
+        io_uring_sqe* sqes{ static_cast<io_uring_sqe*>(MAP_FAILED) };
+        size_t sqesSize{ 0 };
+        unsigned* sqTail{ nullptr };
+        unsigned* sqMask{ nullptr };
+        unsigned* sqArray{ nullptr };
+        unsigned* cqHead{ nullptr };
+        unsigned* cqTail{ nullptr };
+        unsigned* cqMask{ nullptr };
+        io_uring_cqe* cqes{ nullptr };
+
+        uint64_t submitted{ 0 };
+        uint64_t returned{ 0 };
+        // Result of the read that last completed into each buffer, or INT32_MIN while still in flight
+        std::vector<int> results;
+
+        bool Open(const std::string& path) {
+            io_uring_params params{};
+            ringFd = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+            if (ringFd < 0) {
+                return false;
+            }
+            sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (singleMap) {
+                sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+            }
+            sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+            if (sqRing == MAP_FAILED) {
+                return false;
+            }
+            if (singleMap) {
+                cqRing = sqRing;
+            }
+            else {
+                cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+                if (cqRing == MAP_FAILED) {
+                    return false;
+                }
+            }
+            sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES));
+            if (sqes == MAP_FAILED) {
+                return false;
+            }
+
+            char* sq = static_cast<char*>(sqRing);
+            char* cq = static_cast<char*>(cqRing);
+            sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+            cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+            cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+            cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+            cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+            fileFd = open(path.c_str(), O_RDONLY);
+            if (fileFd < 0) {
+                return false;
+            }
+
+            // Fill the pipeline, then check the first read so a kernel without IORING_OP_READ falls back early
+            results.assign(depth, 0);
+            while (submitted < std::min<uint64_t>(blockCount, depth)) {
+                if (!Submit(submitted++)) {
+                    return false;
+                }
+            }
+            return blockCount == 0 || WaitFor(0) != -EINVAL;
+        }
+
+        ~UringBlockReader() override {
+            // Buffers must outlive every read the kernel still owns
+            while (ringFd >= 0 && returned < submitted && fileFd >= 0) {
+                WaitFor(returned++);
+            }
+            if (fileFd >= 0) {
+                close(fileFd);
+            }
+            if (sqes != MAP_FAILED) {
+                munmap(sqes, sqesSize);
+            }
+            if (cqRing != MAP_FAILED && cqRing != sqRing) {
+                munmap(cqRing, cqRingSize);
+            }
+            if (sqRing != MAP_FAILED) {
+                munmap(sqRing, sqRingSize);
+            }
+            if (ringFd >= 0) {
+                close(ringFd);
+            }
+        }
+
+        bool UsesIoUring() const override { return true; }
+
+        bool Submit(uint64_t block) {
+            // We are the only producer, so the tail only needs to be published after the entry is written
+            unsigned tail = *sqTail;
+            unsigned index = tail & *sqMask;
+            io_uring_sqe& sqe = sqes[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_READ;
+            sqe.fd = fileFd;
+            sqe.addr = reinterpret_cast<uint64_t>(Buffer(block));
+            sqe.len = static_cast<uint32_t>(BlockLength(block));
+            sqe.off = offset + block * blockSize;
+            sqe.user_data = block;
+            sqArray[index] = index;
+            __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+            results[block % depth] = std::numeric_limits<int>::min();
+            return syscall(__NR_io_uring_enter, ringFd, 1, 0, 0, nullptr, 0) == 1;
+        }
+
+        // Reaps completions until the given block is in, and returns its read result
+        int WaitFor(uint64_t block) {
+            int& result = results[block % depth];
+            while (result == std::numeric_limits<int>::min()) {
+                unsigned head = *cqHead;
+                if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+                    if (syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR) {
+                        return -EIO;
+                    }
+                    continue;
+                }
+                const io_uring_cqe& cqe = cqes[head & *cqMask];
+                results[cqe.user_data % depth] = cqe.res;
+                __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+            }
+            return result;
+        }
+
+        size_t Next(const char*& data) override {
+            // The block handed out last time is done with, so its buffer takes the next read
+            if (returned > 0 && submitted < blockCount) {
+                if (!Submit(submitted++)) {
+                    return AsyncBlockReader::readFailed;
+                }
+            }
+            if (returned == blockCount) {
+                return 0;
+            }
+
+            uint64_t block = returned++;
+            size_t wanted = BlockLength(block);
+            int result = WaitFor(block);
+            if (result < 0) {
+                return AsyncBlockReader::readFailed;
+            }
+            // Short reads are rare on regular files, finish them synchronously
+            size_t got = static_cast<size_t>(result);
+            while (got < wanted) {
+                ssize_t n = pread(fileFd, Buffer(block) + got, wanted - got, static_cast<off_t>(offset + block * blockSize + got));
+                if (n <= 0) {
+                    return AsyncBlockReader::readFailed;
+                }
+                got += static_cast<size_t>(n);
+            }
+            data = Buffer(block);
+            return wanted;
+        }
+    };
+#endif
+
+    AsyncBlockReader::AsyncBlockReader(const std::string& path, uint64_t offset, uint64_t length, size_t blockSize, unsigned int depth) {
+        if (blockSize == 0) {
+            return;
+        }
+        depth = std::max(depth, 2u);
+#ifdef LAS_IO_URING
+        auto uring = std::make_unique<UringBlockReader>();
+        uring->Init(offset, length, blockSize, depth);
+        if (uring->Open(path)) {
+            backend = std::move(uring);
+            return;
+        }
+        uring.reset();
+#endif
+        auto thread = std::make_unique<ThreadBlockReader>();
+        thread->Init(offset, length, blockSize, depth);
+        if (thread->Open(path)) {
+            backend = std::move(thread);
+        }
+    }
+
+    AsyncBlockReader::~AsyncBlockReader() = default;
+
+    bool AsyncBlockReader::UsesIoUring() const {
+        return backend != nullptr && backend->UsesIoUring();
+    }
+
+    size_t AsyncBlockReader::Next(const char*& data) {
+        return backend != nullptr ? backend->Next(data) : 0;
+    }
+}
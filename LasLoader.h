@@ -1,7 +1,14 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <span>
 #include <cassert>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <utility>
 #include <iostream>
 #include "glm/glm.hpp"
 
@@ -37,32 +44,361 @@ namespace LAS {
         glm::vec3 N;
     };
 
+    struct lasHeader;
+
+    enum LasDecimation : uint32_t {
+        LasDecimateNone = 0,
+        // Keeps every decimationStride'th record
+        LasDecimateStride = 1,
+        // Keeps a seeded random decimationFraction of the records, the same ones on every load
+        LasDecimateRandom = 2,
+        // Keeps the first point that falls in each voxelSize cube
+        LasDecimateVoxel = 3
+    };
+
+    // Optional per point attributes, decoded into their own PointCloud column only when requested
+    enum LasChannel : uint32_t {
+        LasChannelIntensity = 1 << 0,
+        LasChannelClassification = 1 << 1,
+        LasChannelGpsTime = 1 << 2,
+        LasChannelPointSourceID = 1 << 3,
+        // Degrees, from the 8 bit legacy rank or the 0.006 degree steps of formats 6-10
+        LasChannelScanAngle = 1 << 4,
+        // Index of the point's record (or line) in its source file
+        LasChannelRecordIndex = 1 << 5
+    };
+
+    // Points stored column by column, so a pass over positions only streams 12 bytes per point.
+    // Positions and colors are always there, the other columns only when their LasChannel was requested.
+    class PointCloud {
+
+    public:
+        explicit PointCloud(uint32_t channels = 0) : channels(channels) {}
+
+        uint32_t Channels() const { return channels; }
+        bool Has(LasChannel channel) const { return (channels & channel) != 0; }
+        size_t Size() const { return Positions.size(); }
+        bool Empty() const { return Positions.empty(); }
+
+        void Resize(size_t count);
+        void Reserve(size_t count);
+        void Clear();
+        // Adds or drops columns, added ones are zero filled and dropped ones freed
+        void SetChannels(uint32_t channels);
+        // Appends points [first, first + count) of other, channels other lacks are zero filled
+        void Append(const PointCloud& other, size_t first, size_t count);
+        void Append(const PointCloud& other) { Append(other, 0, other.Size()); }
+        void Append(const ColorVertex* vertices, size_t count);
+        // Appends the points of other at the given indices, in that order
+        void AppendSelected(const PointCloud& other, const uint32_t* indices, size_t count);
+        // Moves count points from index from down to index to, used to close gaps
+        void MoveDown(size_t from, size_t to, size_t count);
+        // Keeps the points for which keep(index) is true, in order
+        template<typename Fn>
+        void KeepIf(Fn&& keep);
+
+        ColorVertex Vertex(size_t index) const { return { Positions[index], Colors[index] }; }
+        std::vector<ColorVertex> ToVertices() const;
+
+        std::vector<glm::vec3> Positions;
+        std::vector<glm::vec3> Colors;
+        std::vector<uint16_t> Intensities;
+        std::vector<uint8_t> Classifications;
+        std::vector<double> GpsTimes;
+        std::vector<uint16_t> PointSourceIDs;
+        std::vector<float> ScanAngles;
+        std::vector<uint64_t> RecordIndices;
+    private:
+        template<typename Fn>
+        void ForEachColumn(Fn&& fn);
+
+        uint32_t channels{ 0 };
+    };
+
+    template<typename Fn>
+    void PointCloud::ForEachColumn(Fn&& fn) {
+        fn(Positions);
+        fn(Colors);
+        if (Has(LasChannelIntensity)) fn(Intensities);
+        if (Has(LasChannelClassification)) fn(Classifications);
+        if (Has(LasChannelGpsTime)) fn(GpsTimes);
+        if (Has(LasChannelPointSourceID)) fn(PointSourceIDs);
+        if (Has(LasChannelScanAngle)) fn(ScanAngles);
+        if (Has(LasChannelRecordIndex)) fn(RecordIndices);
+    }
+
+    template<typename Fn>
+    void PointCloud::KeepIf(Fn&& keep) {
+        std::vector<uint8_t> kept(Size());
+        for (size_t i = 0; i < kept.size(); ++i) {
+            kept[i] = keep(i) ? 1 : 0;
+        }
+        ForEachColumn([&](auto& column) {
+            size_t write = 0;
+            for (size_t i = 0; i < kept.size(); ++i) {
+                if (kept[i]) {
+                    column[write++] = column[i];
+                }
+            }
+            column.resize(write);
+        });
+    }
+
+    // Which point records to keep, checked inside the decode loop so rejected records are never converted.
+    // Only las and laz carry these attributes, txt and .lasbin points always pass.
+    struct LasPointFilter {
+        // Classifications to keep, empty keeps every class (e.g. { 2 } for ground only)
+        std::vector<uint8_t> classifications;
+        // Keep only first and/or last returns, with both set a point passes if it is either
+        bool onlyFirstReturns{ false };
+        bool onlyLastReturns{ false };
+        bool dropWithheld{ false };
+        bool dropSynthetic{ false };
+
+        bool IsActive() const { return !classifications.empty() || onlyFirstReturns || onlyLastReturns || dropWithheld || dropSynthetic; }
+    };
+
+    struct LoadSettings {
+        // Worker threads used to decode points, 0 uses one per hardware thread
+        unsigned int threadCount{ 0 };
+        // Directory for the terrain cache, empty disables it. A cache hit restores the mesh buffers and
+        // bounds without reading the source, so GetPointData is empty in that case.
+        std::string cacheDirectory;
+        // Stream .las points through an AsyncBlockReader instead of mapping the file, so reading and decoding overlap
+        bool asyncRead{ false };
+        // Thins points while they are decoded, so memory and triangulation scale with the output instead of the scan
+        LasDecimation decimation{ LasDecimateNone };
+        uint32_t decimationStride{ 1 };
+        float decimationFraction{ 1.f };
+        uint64_t decimationSeed{ 0 };
+        float voxelSize{ 1.f };
+        LasPointFilter filter;
+        // Levels in the terrain pyramid including the full grid, 0 halves until a side is down to 2 vertices
+        int lodLevels{ 0 };
+        // Cells per side of a terrain chunk, up to maxTerrainChunkSize
+        int chunkSize{ 128 };
+        // Width of a terrain grid cell in point units (e.g. 0.25 or 5 meters), vertex positions stay in point units
+        float cellSize{ 1.f };
+        // Extra LasChannel columns to decode next to positions and colors
+        uint32_t channels{ 0 };
+        // Keep whole uncompressed .las clouds as quantized integers (see QuantizedPointStore) instead of floats.
+        // Only a single memory mapped .las read uses it, and only without extra channels or decimation. Async,
+        // region and multi-tile reads and the other formats ignore it and fill the float point data as usual.
+        bool quantizedStorage{ false };
+    };
+
+    // Point cloud kept as the quantized integers of the source instead of floats. Each axis is rebased to its
+    // smallest value and stored in 2, 3 or 4 bytes, colors stay 16 bit, and positions are only dequantized on read.
+    class QuantizedPointStore {
+
+    public:
+        // Sizes the store for count points with raw las X, Y and Z between rawMin and rawMax
+        void Reset(const glm::dvec3& scale, const glm::dvec3& offset, const glm::ivec3& rawMin, const glm::ivec3& rawMax, size_t count, bool hasColor);
+        void Clear();
+        void SetPosition(size_t index, int32_t x, int32_t y, int32_t z);
+        void SetColor(size_t index, uint16_t r, uint16_t g, uint16_t b);
+        // Subtracted from every decoded position, the loader sets it to its centering offset
+        void SetShift(const glm::vec3& shift) { this->shift = shift; }
+
+        size_t Size() const { return count; }
+        bool Empty() const { return count == 0; }
+        bool HasColor() const { return !colors.empty(); }
+        int BytesPerCoordinate(int axis) const { return widths[axis]; }
+        size_t MemoryUsage() const;
+        // Dequantizes points [first, first + n), with the same result as decoding them from the file and
+        // moving them by the shift, so positions match LasLoader::GetPointData
+        void Decode(size_t first, size_t n, ColorVertex* out) const;
+        // Dequantizes the points at indices[0, n), in that order
+        void Decode(const uint32_t* indices, size_t n, ColorVertex* out) const;
+    private:
+        template<typename IndexFn>
+        void DecodeAt(IndexFn&& indexOf, size_t n, ColorVertex* out) const;
+
+        glm::dvec3 scale{ 1.0 };
+        glm::dvec3 offset{ 0.0 };
+        glm::ivec3 base{ 0 };
+        glm::vec3 shift{ 0.f };
+        int widths[3]{ 4, 4, 4 };
+        std::vector<uint8_t> columns[3];
+        std::vector<uint16_t> colors;
+        size_t count{ 0 };
+    };
+
+    struct HeightAndColor {
+        int count{ 0 };
+        float sum{ 0.f };
+        glm::vec3 color{ 0.f };
+    };
+
+    // Width x height cells in one row-major allocation, cell (x, z) lives at x + z * width
+    template<typename T>
+    class Grid2D {
+
+    public:
+        Grid2D() = default;
+        Grid2D(int width, int height, const T& value = T{}) { Reset(width, height, value); }
+
+        void Reset(int width, int height, const T& value = T{}) {
+            this->width = std::max(width, 0);
+            this->height = std::max(height, 0);
+            cells.assign(static_cast<size_t>(this->width) * this->height, value);
+        }
+        // Frees the cells, not just empties them
+        void Clear() { *this = Grid2D(); }
+
+        int Width() const { return width; }
+        int Height() const { return height; }
+        size_t Size() const { return cells.size(); }
+        bool Empty() const { return cells.empty(); }
+        bool Contains(int x, int z) const { return x >= 0 && x < width && z >= 0 && z < height; }
+
+        T& operator()(int x, int z) { return cells[Index(x, z)]; }
+        const T& operator()(int x, int z) const { return cells[Index(x, z)]; }
+        T* Row(int z) { return cells.data() + Index(0, z); }
+        const T* Row(int z) const { return cells.data() + Index(0, z); }
+        T* Data() { return cells.data(); }
+        const T* Data() const { return cells.data(); }
+    private:
+        size_t Index(int x, int z) const { return static_cast<size_t>(z) * width + x; }
+
+        int width{ 0 };
+        int height{ 0 };
+        std::vector<T> cells;
+    };
+
+    // One level of the terrain pyramid. Level 0 is the full grid, each level after it has every second
+    // vertex of the one before, so vertex spacing doubles and vertices line up with the finer levels.
+    struct TerrainLod {
+        // Vertices per row and per column
+        int width{ 0 };
+        int height{ 0 };
+        // Distance between neighbouring vertices in point units, the last row and column may be closer
+        // as they are clamped to the edge of the full grid
+        float spacing{ 0.f };
+        std::vector<ColorNormalVertex> Vertices;
+        std::vector<uint32_t> Indices;
+    };
+
+    // Largest chunk side in cells, (255 + 1)^2 vertices is as many as 16 bit indices can address
+    constexpr int maxTerrainChunkSize = 255;
+
+    // Block of the terrain grid with its own buffers, for culling and streaming. Neighbouring chunks
+    // each hold a copy of the vertices on their shared edge, so they meet without cracks.
+    struct TerrainChunk {
+        // First grid cell covered and the size in cells, so there are (width + 1) x (height + 1) vertices
+        int cellX{ 0 };
+        int cellZ{ 0 };
+        int width{ 0 };
+        int height{ 0 };
+        glm::vec3 boundsMin{ 0.f };
+        glm::vec3 boundsMax{ 0.f };
+        std::vector<ColorNormalVertex> Vertices;
+        std::vector<uint16_t> Indices;
+    };
+
     class LasLoader {
 
     public:
-        LasLoader(const std::string& path);
+        LasLoader(const std::string& path, const LoadSettings& settings = {});
+        // Loads only the points whose x and z (las X and Y) fall inside the box, in file coordinates.
+        // A .las file gets a .lasidx sidecar on first use, so later loads only read the records near the box.
+        LasLoader(const std::string& path, const glm::dvec2& regionMin, const glm::dvec2& regionMax, const LoadSettings& settings = {});
+        // Loads a set of tiles concurrently into one grid. All tiles share the corner of their combined bounds
+        // as origin, so the mesh runs across tile edges without seams. See FindPointFiles for whole directories.
+        LasLoader(const std::vector<std::string>& paths, const LoadSettings& settings = {});
+        // The Get*Data functions return copies, see the views and Take functions below to avoid them
         std::vector<ColorVertex> GetPointData();
+        // Column store with the channels from LoadSettings::channels, empty when the quantized store is used
+        const PointCloud& GetPointCloud() { PreparePoints(); return PointData; }
+        // Filled instead of the float point data when LoadSettings::quantizedStorage applied, decodes to the same positions as GetPointData
+        const QuantizedPointStore& GetQuantizedPointData() { PreparePoints(); return QuantizedPoints; }
         std::pair<std::vector<MeshVertex>, std::vector<uint32_t>> GetIndexedData();
         std::vector<MeshVertex> GetVertexData();
         std::pair<std::vector<ColorNormalVertex>, std::vector<uint32_t>> GetIndexedColorNormalVertexData();
         std::vector<std::vector<std::pair<Triangle, Triangle>>> GetTerrainData();
-        float GetMinY() { return -max.y; }
+        float GetMinY() { Center(); return -max.y; }
+
+        // Views into the loader's own buffers, valid until the loader is destroyed or the buffer is taken
+        std::span<const glm::vec3> GetPositionView() { PreparePoints(); return PointData.Positions; }
+        std::span<const glm::vec3> GetColorView() { PreparePoints(); return PointData.Colors; }
+        std::span<const MeshVertex> GetVertexView() { BuildVertexData(); return VertexData; }
+        std::span<const ColorNormalVertex> GetColorNormalVertexView() { BuildColorNormalVertexData(); return ColorNormalVertexData; }
+        std::span<const uint32_t> GetIndexView() { BuildIndexData(); return IndexData; }
+
+        // Move a buffer out without copying, the loader is left with an empty one. Asking for a taken
+        // buffer again builds it anew, taken points are read from the sources again if anything needs them.
+        // Both vertex layouts share the index buffer, so take it last.
+        PointCloud TakePointCloud();
+        std::vector<MeshVertex> TakeVertexData() { BuildVertexData(); vertexDataBuilt = false; return std::exchange(VertexData, {}); }
+        std::vector<ColorNormalVertex> TakeColorNormalVertexData() { BuildColorNormalVertexData(); colorNormalVertexDataBuilt = false; return std::exchange(ColorNormalVertexData, {}); }
+        std::vector<uint32_t> TakeIndexData() { BuildIndexData(); indexDataBuilt = false; return std::exchange(IndexData, {}); }
+
+        // Mip style pyramid with its own vertex and index buffers per level, see LoadSettings::lodLevels
+        const std::vector<TerrainLod>& GetTerrainLods() { BuildTerrainLods(); return TerrainLods; }
+        std::vector<TerrainLod> TakeTerrainLods() { BuildTerrainLods(); terrainLodsBuilt = false; return std::exchange(TerrainLods, {}); }
+        // The full grid cut into LoadSettings::chunkSize square chunks, in row order
+        const std::vector<TerrainChunk>& GetTerrainChunks() { BuildTerrainChunks(); return TerrainChunks; }
+        std::vector<TerrainChunk> TakeTerrainChunks() { BuildTerrainChunks(); terrainChunksBuilt = false; return std::exchange(TerrainChunks, {}); }
     private:
-        std::vector<ColorVertex> PointData;
+        LoadSettings settings;
+        PointCloud PointData;
+        QuantizedPointStore QuantizedPoints;
         std::vector<MeshVertex> VertexData;
         std::vector<ColorNormalVertex> ColorNormalVertexData;
         std::vector<uint32_t> IndexData;
+        std::vector<TerrainLod> TerrainLods;
+        std::vector<TerrainChunk> TerrainChunks;
         std::vector<MeshVertex> TriangulatedVertexData;
         std::vector<Triangle> triangles;
 
+        // Reads, clips and decimates the points of one tile of a multi-tile load
+        struct TileTag {};
+        LasLoader(const std::string& path, const LoadSettings& settings, TileTag);
+
+        void Load(const std::vector<std::string>& paths);
+        void ReadPoints(const std::string& path);
+        void ReadTile(const std::string& path);
+        void ReadTiles(const std::vector<std::string>& paths);
         void ReadTxt(const std::string& path);
         void ReadBin(const std::string& path);
         void ReadLas(const std::string& path);
+        void ReadLasBuffered(const std::string& path);
+        void ReadLasAsync(const std::string& path);
+        bool ReadLasRegion(const std::string& path);
+        void ReadLasQuantized(const lasHeader& header, const char* records, size_t count);
+        void ReadLaz(const std::string& path);
+        void SetBoundsFromHeader(const lasHeader& header);
+        void ClipToRegion();
+        void DecimatePoints();
 
+        // Stages after reading run the first time an output needs them and are not repeated
+        void PreparePoints();
+        void Center();
         void CalcCenter();
         void FindMinMax();
+        template<typename Fn>
+        void ForEachPoint(Fn&& fn) const;
+        template<typename Fn>
+        void ForEachPoint(size_t begin, size_t end, Fn&& fn) const;
+        size_t PointCount() const { return QuantizedPoints.Empty() ? PointData.Size() : QuantizedPoints.Size(); }
+        void BinPoints(Grid2D<HeightAndColor>& heightmap) const;
         void UpdatePoints();
         void Triangulate();
+        void BuildVertexData();
+        void BuildColorNormalVertexData();
+        void BuildIndexData();
+        void BuildTerrainLods();
+        void BuildTerrainChunks();
+        bool RestoreGrid();
+        void SavePendingCache();
+        float CellSize() const { return settings.cellSize > 0.f ? settings.cellSize : 1.f; }
+        // Position of grid vertex (x, z) in the same units as the points
+        glm::vec3 GridPosition(int x, int z, float height) const { return glm::vec3(x * CellSize(), height, z * CellSize()); }
+        void ReleaseGrid();
+
+        std::string TerrainCacheKey(const std::vector<std::string>& paths) const;
+        bool LoadTerrainCache(const std::string& cachePath, const std::string& key);
+        void SaveTerrainCache(const std::string& cachePath, const std::string& key) const;
 
         glm::vec3 min{ 0.f };
         glm::vec3 max{ 0.f };
@@ -70,12 +406,29 @@ namespace LAS {
         glm::vec3 offset{ 0.f };
         int xSquares{ 0 };
         int zSquares{ 0 };
-    };
 
-    struct HeightAndColor {
-        int count{ 0 };
-        float sum{ 0.f };
-        glm::vec3 color{ 0.f };
+        // Averaged height and color per grid cell, kept until both vertex layouts are built
+        Grid2D<float> gridHeights;
+        Grid2D<glm::vec3> gridColors;
+        bool centered{ false };
+        bool triangulated{ false };
+        bool vertexDataBuilt{ false };
+        bool colorNormalVertexDataBuilt{ false };
+        bool indexDataBuilt{ false };
+        bool terrainLodsBuilt{ false };
+        bool terrainChunksBuilt{ false };
+
+        // Set while a cache miss still has to be written, once the mesh is built
+        std::string cacheKey;
+        std::string cachePath;
+        // Sources of a warm cache load or of taken points, their points are only read if something asks for them
+        std::vector<std::string> skippedPaths;
+        std::vector<std::string> sourcePaths;
+
+        bool pointsDecimated{ false };
+        bool hasRegion{ false };
+        glm::dvec2 regionMin{ 0.0 };
+        glm::dvec2 regionMax{ 0.0 };
     };
 
     // Can't use struct directly because of padding of the size of the struct
@@ -105,9 +458,15 @@ namespace LAS {
         double maxX, minX;
         double maxY, minY;
         double maxZ, minZ;
+        // LAS 1.3
+        uint64_t startOfWaveformDataPacketRecord;
+        // LAS 1.4 (numberOfPointRecords is filled from the legacy count for older files)
+        uint64_t startOfFirstExtendedVariableLengthRecord;
+        uint32_t numberOfExtendedVariableLengthRecords;
+        uint64_t numberOfPointRecords;
+        uint64_t numberOfPointsByReturn[15];
     };
 
-    // Not needed
     struct lasVariableLengthRecords {
         // Variable Length Records
         uint16_t lasReserved;
@@ -147,4 +506,313 @@ namespace LAS {
         uint16_t blue;
     };
 
+    // Compile time layout of a point data record format (LAS 1.4 formats 0-10), as byte offsets into the record
+    template<uint8_t Format>
+    struct LasPointFormat {
+        static_assert(Format <= 10, "LAS 1.4 only defines point data record formats 0-10");
+
+        // Formats 6-10 use the 1.4 layout with 4 bit returns, 8 bit classification and a 16 bit scan angle
+        static constexpr bool extended = Format >= 6;
+        static constexpr bool hasGpsTime = Format != 0 && Format != 2;
+        static constexpr bool hasColor = Format == 2 || Format == 3 || Format == 5 || Format == 7 || Format == 8 || Format == 10;
+        static constexpr bool hasNir = Format == 8 || Format == 10;
+        static constexpr bool hasWavePacket = Format == 4 || Format == 5 || Format == 9 || Format == 10;
+
+        static constexpr size_t intensityOffset = 12;
+        static constexpr size_t returnsOffset = 14;
+        static constexpr size_t classificationOffset = extended ? 16 : 15;
+        static constexpr size_t scanAngleOffset = extended ? 18 : 16;
+        static constexpr size_t userDataOffset = 17;
+        static constexpr size_t pointSourceIDOffset = extended ? 20 : 18;
+        static constexpr size_t gpsTimeOffset = extended ? 22 : 20;
+        static constexpr size_t colorOffset = extended ? 30 : (hasGpsTime ? 28 : 20);
+        static constexpr size_t nirOffset = 36;
+        static constexpr size_t wavePacketOffset = (extended ? 30 : 28) + (hasColor ? 6 : 0) + (hasNir ? 2 : 0);
+
+        // Minimum record length, files may append extra bytes after it
+        static constexpr size_t recordLength = hasWavePacket ? wavePacketOffset + 29
+            : hasNir ? nirOffset + 2
+            : hasColor ? colorOffset + 6
+            : hasGpsTime ? gpsTimeOffset + 8
+            : 20;
+    };
+
+    // .lasbin header, followed by pointCount points. Version 3 (written) stores each channel as a column,
+    // version 2 interleaves them per point. Version 1 files have no header and are a bare array of las
+    // ordered (z up) glm::vec3. The struct has no padding and is written as is.
+    struct lasBinHeader {
+        char signature[8];
+        uint32_t version;
+        uint32_t headerSize;
+        uint64_t pointCount;
+        uint32_t axis;
+        uint32_t channels;
+        float minX, minY, minZ;
+        float maxX, maxY, maxZ;
+    };
+
+    constexpr char lasBinSignature[8] = { 'L', 'A', 'S', 'B', 'I', 'N', '\0', '\0' };
+
+    // Axis convention of the stored positions, y up matches PointData
+    enum LasBinAxis : uint32_t {
+        LasBinYUp = 0,
+        LasBinZUp = 1
+    };
+
+    // Per point attributes, stored in this order. Interleaved position + color is the layout of ColorVertex.
+    enum LasBinChannel : uint32_t {
+        LasBinPosition = 1 << 0,
+        LasBinColor = 1 << 1
+    };
+
+    // Read-only memory mapping of a whole file, unmapped on destruction
+    class MappedFile {
+
+    public:
+        MappedFile() = default;
+        explicit MappedFile(const std::string& path);
+        ~MappedFile();
+        MappedFile(MappedFile&& other) noexcept;
+        MappedFile& operator=(MappedFile&& other) noexcept;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool IsOpen() const { return data != nullptr; }
+        const char* Data() const { return data; }
+        size_t Size() const { return size; }
+    private:
+        void Close();
+
+        const char* data{ nullptr };
+        size_t size{ 0 };
+#ifdef _WIN32
+        void* fileHandle{ nullptr };
+        void* mappingHandle{ nullptr };
+#endif
+    };
+
+    // Reads a byte range of a file as consecutive blocks while keeping several reads in flight.
+    // Uses io_uring where the kernel allows it, and a prefetching thread everywhere else.
+    class AsyncBlockReader {
+
+    public:
+        AsyncBlockReader(const std::string& path, uint64_t offset, uint64_t length, size_t blockSize, unsigned int depth = 4);
+        ~AsyncBlockReader();
+        AsyncBlockReader(const AsyncBlockReader&) = delete;
+        AsyncBlockReader& operator=(const AsyncBlockReader&) = delete;
+
+        // Returned by Next instead of a length when a read failed, so it is never mistaken for the end
+        static constexpr size_t readFailed = ~size_t(0);
+
+        bool IsOpen() const { return backend != nullptr; }
+        bool UsesIoUring() const;
+        // Next block in file order, valid until the following call. Returns 0 at the end and readFailed on a read error.
+        size_t Next(const char*& data);
+
+        struct Backend;
+    private:
+        std::unique_ptr<Backend> backend;
+    };
+
+    // A single raw point record, read straight out of the file mapping
+    class LasRecord {
+
+    public:
+        explicit LasRecord(const char* data) : data(data) {}
+
+        // Records are packed, so fields are copied out unaligned
+        template<typename T>
+        T Get(size_t fieldOffset) const {
+            T value;
+            std::memcpy(&value, data + fieldOffset, sizeof(T));
+            return value;
+        }
+
+        int32_t X() const { return Get<int32_t>(0); }
+        int32_t Y() const { return Get<int32_t>(4); }
+        int32_t Z() const { return Get<int32_t>(8); }
+        uint16_t Intensity() const { return Get<uint16_t>(12); }
+        const char* Data() const { return data; }
+
+        lasPointData1 AsFormat1() const;
+        lasPointData2 AsFormat2() const;
+    private:
+        const char* data;
+    };
+
+    // Iterates the raw point records of a mapped las file without copying them
+    class LasPointView {
+
+    public:
+        class Iterator {
+
+        public:
+            Iterator(const char* data, size_t stride) : data(data), stride(stride) {}
+            LasRecord operator*() const { return LasRecord(data); }
+            Iterator& operator++() { data += stride; return *this; }
+            bool operator!=(const Iterator& other) const { return data != other.data; }
+            bool operator==(const Iterator& other) const { return data == other.data; }
+        private:
+            const char* data;
+            size_t stride;
+        };
+
+        LasPointView() = default;
+        LasPointView(const char* data, size_t count, size_t stride) : data(data), count(count), stride(stride) {}
+
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        size_t Stride() const { return stride; }
+        LasRecord operator[](size_t i) const { return LasRecord(data + i * stride); }
+        Iterator begin() const { return Iterator(data, stride); }
+        Iterator end() const { return Iterator(data + count * stride, stride); }
+    private:
+        const char* data{ nullptr };
+        size_t count{ 0 };
+        size_t stride{ 0 };
+    };
+
+    // A memory mapped las file: parsed header plus a view of its point records
+    class LasFile {
+
+    public:
+        explicit LasFile(const std::string& path);
+
+        bool IsOpen() const { return valid; }
+        const lasHeader& Header() const { return header; }
+        LasPointView Points() const;
+    private:
+        MappedFile file;
+        lasHeader header{};
+        bool valid{ false };
+    };
+
+    // Size of the LAS 1.4 header, the largest one ReadLasHeader looks at
+    constexpr size_t lasHeaderMaxSize = 375;
+
+    // Number of point records read and decoded together by the buffered reader
+    constexpr size_t lasBlockSize = 8192;
+
+    // Pull style reader that decodes a las file a fixed size batch at a time.
+    // Only one batch worth of records is held in memory, so files larger than RAM can be processed.
+    class LasPointStream {
+
+    public:
+        explicit LasPointStream(const std::string& path, size_t batchSize = lasBlockSize);
+
+        bool IsOpen() const { return valid; }
+        const lasHeader& Header() const { return header; }
+        uint64_t PointsRead() const { return pointsRead; }
+
+        // Decodes up to min(maxPoints, batch size) points into out, returns 0 once the file is exhausted
+        size_t Read(ColorVertex* out, size_t maxPoints);
+        // Replaces batch with the next decoded batch, returns false once the file is exhausted
+        bool Next(std::vector<ColorVertex>& batch);
+        // Skips records the filter rejects, Read and Next then only return the ones that pass
+        void SetFilter(const LasPointFilter& filter) { this->filter = filter; }
+    private:
+        std::ifstream file;
+        lasHeader header{};
+        std::vector<char> buffer;
+        LasPointFilter filter;
+        size_t batchSize;
+        uint64_t pointsRead{ 0 };
+        bool valid{ false };
+    };
+
+    // Calls onBatch with each decoded batch of world space points and returns how many points were read
+    uint64_t StreamLas(const std::string& path, size_t batchSize, const std::function<void(const ColorVertex*, size_t)>& onBatch);
+
+    // Half open range [first, last) of point record indices
+    struct LasRecordRange {
+        uint64_t first;
+        uint64_t last;
+    };
+
+    // Quadtree over the XY plane of a las file. Each leaf lists the record ranges whose points fall inside it,
+    // in the spirit of LAX, so a box query only has to read and decode those ranges.
+    class LasSpatialIndex {
+
+    public:
+        // Builds the tree from the records of a mapped las file, starting at its point data.
+        // recordCount is the number of records the file actually holds, see LasFile::Points
+        void Build(const lasHeader& header, const char* records, uint64_t recordCount);
+        // Fails if the file is missing, corrupt or was built for a different header or record count
+        bool Load(const std::string& path, const lasHeader& header, uint64_t recordCount);
+        bool Save(const std::string& path) const;
+
+        bool IsBuilt() const { return built; }
+        // Sorted, merged record ranges that may hold points inside the box
+        std::vector<LasRecordRange> Query(double minX, double minY, double maxX, double maxY) const;
+
+        struct Cell {
+            uint32_t level;
+            uint32_t x;
+            uint32_t y;
+            uint32_t firstRange;
+            uint32_t rangeCount;
+        };
+    private:
+        void GetCellBounds(const Cell& cell, double& minX, double& minY, double& maxX, double& maxY) const;
+
+        double minX{ 0.0 };
+        double minY{ 0.0 };
+        double maxX{ 0.0 };
+        double maxY{ 0.0 };
+        uint64_t pointCount{ 0 };
+        uint32_t offsetToPointData{ 0 };
+        uint16_t recordLength{ 0 };
+        std::vector<Cell> cells;
+        std::vector<LasRecordRange> ranges;
+        bool built{ false };
+    };
+
+    // Sidecar path of the spatial index for a las file, the same path with a .lasidx extension
+    std::string LasIndexPath(const std::string& lasPath);
+
+    // Point files (.las, .laz, .lasbin and .txt) directly inside a directory, sorted by name
+    std::vector<std::string> FindPointFiles(const std::string& directory);
+
+    // Header of a variable length record, or of a LAS 1.4 extended one, without its payload
+    struct LasVlrInfo {
+        std::string userID;
+        uint16_t recordID{ 0 };
+        uint64_t length{ 0 };
+        std::string description;
+        bool extended{ false };
+    };
+
+    // What a header-only scan learns about one file
+    struct LasFileInfo {
+        std::string path;
+        // False if the file could not be opened or does not start with a las header
+        bool valid{ false };
+        // LASzip marks compressed point formats with the top bits, they are cleared in header
+        bool compressed{ false };
+        uint64_t fileSize{ 0 };
+        lasHeader header{};
+        std::vector<LasVlrInfo> vlrs;
+    };
+
+    // Catalogues .las and .laz files by reading only their headers, and the VLR headers if readVlrs is set.
+    // Files are scanned in parallel and no point data is touched. Results are in the order of paths.
+    std::vector<LasFileInfo> ScanLasFiles(const std::vector<std::string>& paths, bool readVlrs = true, unsigned int threadCount = 0);
+
+    // Writes points as a version 3 .lasbin (y up, a position column then a color column) that loads one read per column
+    bool WriteLasBin(const std::string& path, const std::vector<ColorVertex>& points);
+    // Converts a las file into a version 3 .lasbin without holding the whole cloud in memory.
+    // The source is read twice, once for the position column and once for the color column.
+    bool ConvertToLasBin(const std::string& lasPath, const std::string& binPath);
+
+    bool ReadLasHeader(const char* data, size_t size, lasHeader& header);
+    bool IsLasFormatSupported(const lasHeader& header);
+    size_t LasRecordLength(uint8_t format);
+    void DecodeLasBlock(const lasHeader& header, const char* records, size_t count, ColorVertex* out);
+    // Decodes only the records the filter keeps, packed at the start of out, and returns how many there were
+    size_t DecodeLasBlock(const lasHeader& header, const char* records, size_t count, const LasPointFilter& filter, ColorVertex* out);
+
+    // Converts raw las coordinates to positions, with las z as the up axis (Pos.y). Colors are left untouched.
+    // Picks an AVX or SSE2 kernel at runtime; results are identical to the scalar double-then-float path.
+    void DequantizePositions(const lasHeader& header, const int32_t* x, const int32_t* y, const int32_t* z, size_t count, ColorVertex* out);
+
 }
\ No newline at end of file
@@ -1,7 +1,148 @@
 ﻿#include "LasToVertex.h"
+#include "LasLoader.h"
 
-int main()
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Reads the point records one field at a time, the way ReadLas originally did
+static size_t ReadPerField(const std::string& path)
+{
+	std::ifstream inf(path, std::ios::binary);
+	char headerBytes[LAS::lasHeaderMaxSize];
+	inf.read(headerBytes, sizeof(headerBytes));
+	LAS::lasHeader header;
+	if (!LAS::ReadLasHeader(headerBytes, static_cast<size_t>(inf.gcount()), header))
+		return 0;
+
+	inf.clear();
+	std::vector<LAS::ColorVertex> points;
+	for (int i = 0; i < header.legacyNumberPointsRecords; ++i) {
+		LAS::lasPointData2 temp{};
+		inf.seekg(header.offsetToPointData + (header.pointDataRecordLength * i));
+		inf.read((char*)&temp.xPos, sizeof(temp.xPos));
+		inf.read((char*)&temp.yPos, sizeof(temp.yPos));
+		inf.read((char*)&temp.zPos, sizeof(temp.zPos));
+		inf.read((char*)&temp.intensity, sizeof(temp.intensity));
+		inf.read((char*)&temp.flags, sizeof(temp.flags));
+		inf.read((char*)&temp.classificaton, sizeof(temp.classificaton));
+		inf.read((char*)&temp.scanAngle, sizeof(temp.scanAngle));
+		inf.read((char*)&temp.userData, sizeof(temp.userData));
+		inf.read((char*)&temp.pointSourceID, sizeof(temp.pointSourceID));
+		if (header.pointDataRecordFormat == 2) {
+			inf.read((char*)&temp.red, sizeof(temp.red));
+			inf.read((char*)&temp.green, sizeof(temp.green));
+			inf.read((char*)&temp.blue, sizeof(temp.blue));
+		}
+
+		LAS::ColorVertex tempVertex{};
+		tempVertex.Pos.x = (temp.xPos * header.xScaleFactor) + header.xOffset;
+		tempVertex.Pos.y = (temp.zPos * header.zScaleFactor) + header.zOffset;
+		tempVertex.Pos.z = (temp.yPos * header.yScaleFactor) + header.yOffset;
+		tempVertex.Color = glm::vec3(temp.red * 0.00001, temp.green * 0.00001, temp.blue * 0.00001);
+		points.push_back(tempVertex);
+	}
+	return points.size();
+}
+
+// Reads lasBlockSize records per call and unpacks them with DecodeLasBlock
+static size_t ReadBlocks(const std::string& path)
+{
+	LAS::LasPointStream stream(path);
+	if (!stream.IsOpen())
+		return 0;
+
+	std::vector<LAS::ColorVertex> points(static_cast<size_t>(stream.Header().numberOfPointRecords));
+	size_t done = 0;
+	while (size_t n = stream.Read(points.data() + done, points.size() - done))
+		done += n;
+	return done;
+}
+
+// Streams fixed size batches without ever holding the whole cloud
+static size_t ReadStreamed(const std::string& path)
+{
+	return static_cast<size_t>(LAS::StreamLas(path, LAS::lasBlockSize, [](const LAS::ColorVertex*, size_t) {}));
+}
+
+// Decodes every record straight out of the file mapping
+static size_t ReadMapped(const std::string& path)
+{
+	LAS::LasFile file(path);
+	if (!file.IsOpen() || !LAS::IsLasFormatSupported(file.Header()))
+		return 0;
+
+	LAS::LasPointView records = file.Points();
+	std::vector<LAS::ColorVertex> points(records.size());
+	if (!records.empty())
+		LAS::DecodeLasBlock(file.Header(), records[0].Data(), records.size(), points.data());
+	return points.size();
+}
+
+// Decodes each block while the next reads are in flight
+static size_t ReadAsync(const std::string& path)
+{
+	LAS::LasPointStream stream(path);
+	if (!stream.IsOpen() || !LAS::IsLasFormatSupported(stream.Header()))
+		return 0;
+
+	// Never read further than the file actually reaches
+	const LAS::lasHeader& header = stream.Header();
+	const size_t stride = header.pointDataRecordLength;
+	std::error_code error;
+	uint64_t fileSize = std::filesystem::file_size(path, error);
+	uint64_t available = !error && fileSize > header.offsetToPointData ? (fileSize - header.offsetToPointData) / stride : 0;
+	size_t total = static_cast<size_t>(std::min<uint64_t>(header.numberOfPointRecords, available));
+
+	LAS::AsyncBlockReader reader(path, header.offsetToPointData, static_cast<uint64_t>(total) * stride, (size_t(4) << 20) / stride * stride);
+	std::vector<LAS::ColorVertex> points(total);
+	size_t done = 0;
+	const char* block = nullptr;
+	size_t bytes;
+	while ((bytes = reader.Next(block)) != 0 && bytes != LAS::AsyncBlockReader::readFailed)
+	{
+		size_t count = std::min(bytes / stride, points.size() - done);
+		LAS::DecodeLasBlock(header, block, count, points.data() + done);
+		done += count;
+	}
+	if (bytes == LAS::AsyncBlockReader::readFailed) {
+		std::cout << "Read error: " << path << std::endl;
+		return 0;
+	}
+	return done;
+}
+
+static void Benchmark(const char* name, const std::string& path, const std::function<size_t(const std::string&)>& read)
+{
+	// Best of a few runs, so the first one can warm the page cache
+	constexpr int runs = 3;
+	double best = 0.0;
+	size_t count = 0;
+	for (int i = 0; i < runs; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		count = read(path);
+		std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+		if (seconds.count() > 0.0)
+			best = std::max(best, count / seconds.count());
+	}
+	std::cout << name << ": " << count << " points, " << static_cast<size_t>(best) << " points/s" << std::endl;
+}
+
+int main(int argc, char* argv[])
 {
 	std::cout << "Hello, I'm LastToVertex." << std::endl;
+
+	// LasToVertex --bench <file.las> compares the las read paths on the same file
+	if (argc == 3 && std::string(argv[1]) == "--bench") {
+		Benchmark("per field", argv[2], ReadPerField);
+		Benchmark("block", argv[2], ReadBlocks);
+		Benchmark("streamed", argv[2], ReadStreamed);
+		Benchmark("mapped", argv[2], ReadMapped);
+		Benchmark("async", argv[2], ReadAsync);
+	}
 	return 0;
 }